@@ -0,0 +1,353 @@
+/**
+* Description: Asset manager. Models and textures are requested by path and
+* come back as handles right away. Files are read and decoded on worker
+* threads, then uploaded on the GL thread by update, within a time budget per
+* frame. Lookups return a placeholder until an asset is ready. Textures are
+* cooked on the workers, see texture_cooker.h, and kept next to the BMP, then
+* staged in the UploadRing so their upload doesn't stall the frame.
+*/
+
+#include "asset_manager.h"
+#include "raw_model.h"
+#include "texture_loader.h"
+#include "upload_ring.h"
+#include "gl_state.h"
+#include "cpu_profiler.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#define ASSET_INDEX_BITS 16
+#define ASSET_INDEX_MASK ((1u << ASSET_INDEX_BITS) - 1)
+
+enum AssetType { ASSET_MODEL, ASSET_TEXTURE };
+
+struct Asset {
+    AssetType type;
+    std::string path;
+    glm::vec3 size;
+    unsigned int references;
+    AssetState state;
+    // Released while a worker had it, freed when it comes back.
+    bool abandoned;
+
+    // Decoded by a worker, only touched by it until it is queued as decoded.
+    bool decoded;
+    mesh::MeshData* mesh;
+    texture::TextureData image;
+    // Segment of the UploadRing the image was staged in, if any.
+    int staging;
+
+    // Uploaded.
+    _RawModel* model;
+    GLuint texture;
+};
+
+// A handle names a slot. Freeing the asset bumps the slot's generation.
+struct AssetSlot {
+    Asset* asset;
+    unsigned int generation;
+};
+
+static std::vector<AssetSlot> asset_slots;
+static std::vector<unsigned int> asset_free_slots;
+static std::map<std::pair<int, std::string>, AssetHandle> asset_paths;
+static GLuint asset_placeholder_texture = GL_NONE;
+// Textures are cooked to S3TC when the driver has it, set once before the workers start.
+static bool asset_compressed_textures = false;
+
+// Requested and not yet through update, only used on the GL thread.
+static unsigned int asset_in_flight = 0;
+
+// Shared with the workers.
+static std::mutex asset_mutex;
+static std::condition_variable asset_work_ready, asset_decoded_ready;
+static std::deque<Asset*> asset_work, asset_decoded;
+static std::vector<std::thread> asset_workers;
+static bool asset_stopping = false;
+
+static Asset* resolve(AssetHandle handle) {
+    unsigned int index = handle & ASSET_INDEX_MASK;
+    unsigned int generation = handle >> ASSET_INDEX_BITS;
+
+    if (index >= asset_slots.size() || asset_slots[index].generation != generation) {
+        return NULL;
+    }
+    return asset_slots[index].asset;
+}
+
+// Read and decode, without touching GL.
+static void decode(Asset* asset) {
+    CpuProfileZone zone("asset decode");
+
+    if (asset->type == ASSET_MODEL) {
+        asset->mesh = new mesh::MeshData();
+        asset->decoded = mesh::readObj(asset->path, *asset->mesh);
+    }
+    else {
+        asset->decoded = texture::readTexture(asset->path, asset_compressed_textures, asset->image);
+
+        // Staged here when a segment is free, the GL thread then only
+        // points the driver at it.
+        if (asset->decoded) {
+            asset->staging = UploadRing::acquire(texture::_textureSize(asset->image));
+            if (asset->staging != UPLOAD_RING_NONE) {
+                texture::stageTexture(asset->image, UploadRing::getPointer(asset->staging));
+            }
+        }
+    }
+}
+
+static void work() {
+    for (;;) {
+        Asset* asset;
+        bool abandoned;
+        {
+            std::unique_lock<std::mutex> lock(asset_mutex);
+            asset_work_ready.wait(lock, [] { return asset_stopping || !asset_work.empty(); });
+            if (asset_stopping) return;
+
+            asset = asset_work.front();
+            asset_work.pop_front();
+            abandoned = asset->abandoned;
+        }
+
+        // Nobody wants it anymore, hand it straight back to be freed.
+        if (!abandoned) decode(asset);
+
+        {
+            std::lock_guard<std::mutex> lock(asset_mutex);
+            asset_decoded.push_back(asset);
+        }
+        asset_decoded_ready.notify_one();
+    }
+}
+
+static void destroy(Asset* asset) {
+    delete asset->model;
+    delete asset->mesh;
+    if (asset->texture != GL_NONE) {
+        GLState::forgetTexture(asset->texture);
+        glDeleteTextures(1, &asset->texture);
+    }
+    if (asset->staging != UPLOAD_RING_NONE) UploadRing::discard(asset->staging);
+    delete asset;
+}
+
+static void upload(Asset* asset) {
+    if (!asset->decoded) {
+        std::cout << "Asset Manager: could not load " << asset->path << std::endl;
+        asset->state = ASSET_FAILED;
+    }
+    else if (asset->type == ASSET_MODEL) {
+        asset->model = new _RawModel(asset->size, *asset->mesh);
+        asset->state = ASSET_READY;
+    }
+    else {
+        // Cooked with every mip level, nothing is generated here.
+        if (asset->staging != UPLOAD_RING_NONE) {
+            asset->texture = texture::uploadStagedTexture(asset->image, UploadRing::bind(asset->staging));
+            UploadRing::submit(asset->staging);
+            asset->staging = UPLOAD_RING_NONE;
+        }
+        else {
+            asset->texture = texture::uploadTexture(asset->image);
+        }
+        asset->state = ASSET_READY;
+    }
+
+    // The decoded copy is on the GPU now.
+    delete asset->mesh;
+    asset->mesh = NULL;
+    std::vector<texture::TextureLevel>().swap(asset->image.levels);
+}
+
+static AssetHandle request(AssetType type, const std::string& path, glm::vec3 size) {
+    std::pair<int, std::string> key(type, path);
+    std::map<std::pair<int, std::string>, AssetHandle>::iterator found = asset_paths.find(key);
+
+    if (found != asset_paths.end()) {
+        AssetManager::acquire(found->second);
+        return found->second;
+    }
+
+    unsigned int index;
+    if (!asset_free_slots.empty()) {
+        index = asset_free_slots.back();
+        asset_free_slots.pop_back();
+    }
+    else {
+        index = (unsigned int)asset_slots.size();
+        AssetSlot slot = { NULL, 1 };
+        asset_slots.push_back(slot);
+    }
+
+    Asset* asset = new Asset();
+    asset->type = type;
+    asset->path = path;
+    asset->size = size;
+    asset->references = 1;
+    asset->state = ASSET_LOADING;
+    asset->abandoned = false;
+    asset->decoded = false;
+    asset->mesh = NULL;
+    asset->model = NULL;
+    asset->texture = GL_NONE;
+    asset->staging = UPLOAD_RING_NONE;
+    asset_slots[index].asset = asset;
+
+    AssetHandle handle = index | (asset_slots[index].generation << ASSET_INDEX_BITS);
+    asset_paths[key] = handle;
+
+    asset_in_flight++;
+    {
+        std::lock_guard<std::mutex> lock(asset_mutex);
+        asset_work.push_back(asset);
+    }
+    asset_work_ready.notify_one();
+
+    return handle;
+}
+
+void AssetManager::initialize() {
+    // Mid grey, so untextured surfaces still shade.
+    const std::uint8_t grey[3] = { 128, 128, 128 };
+    glGenTextures(1, &asset_placeholder_texture);
+    GLState::bindTexture(0, GL_TEXTURE_2D, asset_placeholder_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    asset_compressed_textures = GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+    if (!UploadRing::initialize()) {
+        std::cout << "Asset Manager: no ARB_buffer_storage, textures upload from memory" << std::endl;
+    }
+
+    asset_stopping = false;
+    for (int i = 0; i < ASSET_WORKER_COUNT; i++) {
+        asset_workers.push_back(std::thread(work));
+    }
+}
+
+void AssetManager::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(asset_mutex);
+        asset_stopping = true;
+    }
+    asset_work_ready.notify_all();
+    for (size_t i = 0; i < asset_workers.size(); i++) {
+        asset_workers[i].join();
+    }
+    asset_workers.clear();
+
+    // Whatever is still queued or decoded is in the slots too, unless it
+    // was abandoned, and then it is only in the queues.
+    for (size_t i = 0; i < asset_work.size(); i++) {
+        if (asset_work[i]->abandoned) destroy(asset_work[i]);
+    }
+    for (size_t i = 0; i < asset_decoded.size(); i++) {
+        if (asset_decoded[i]->abandoned) destroy(asset_decoded[i]);
+    }
+    asset_work.clear();
+    asset_decoded.clear();
+
+    for (size_t i = 0; i < asset_slots.size(); i++) {
+        if (asset_slots[i].asset) destroy(asset_slots[i].asset);
+    }
+    asset_slots.clear();
+    asset_free_slots.clear();
+    asset_paths.clear();
+    asset_in_flight = 0;
+
+    GLState::forgetTexture(asset_placeholder_texture);
+    glDeleteTextures(1, &asset_placeholder_texture);
+    asset_placeholder_texture = GL_NONE;
+    UploadRing::shutdown();
+}
+
+AssetHandle AssetManager::loadModel(const std::string& path, glm::vec3 size) {
+    return request(ASSET_MODEL, path, size);
+}
+
+AssetHandle AssetManager::loadTexture(const std::string& path) {
+    return request(ASSET_TEXTURE, path, glm::vec3(0));
+}
+
+void AssetManager::acquire(AssetHandle handle) {
+    Asset* asset = resolve(handle);
+    if (asset) asset->references++;
+}
+
+void AssetManager::release(AssetHandle handle) {
+    Asset* asset = resolve(handle);
+    if (!asset || --asset->references > 0) return;
+
+    unsigned int index = handle & ASSET_INDEX_MASK;
+    asset_paths.erase(std::pair<int, std::string>(asset->type, asset->path));
+    asset_slots[index].asset = NULL;
+    asset_slots[index].generation = (asset_slots[index].generation + 1) & (~0u >> ASSET_INDEX_BITS);
+    if (asset_slots[index].generation == 0) asset_slots[index].generation = 1;
+    asset_free_slots.push_back(index);
+
+    // A worker may still have it, update frees it when it comes back.
+    if (asset->state == ASSET_LOADING) {
+        std::lock_guard<std::mutex> lock(asset_mutex);
+        asset->abandoned = true;
+    }
+    else {
+        destroy(asset);
+    }
+}
+
+void AssetManager::update(double budget) {
+    uint64_t start = CpuProfiler::now();
+    uint64_t limit = (uint64_t)(budget * 1000000.0);
+
+    // Staging segments the GPU is done with take new textures again.
+    UploadRing::update();
+
+    while (asset_in_flight > 0) {
+        Asset* asset;
+        {
+            std::lock_guard<std::mutex> lock(asset_mutex);
+            if (asset_decoded.empty()) return;
+            asset = asset_decoded.front();
+            asset_decoded.pop_front();
+        }
+        asset_in_flight--;
+
+        // Only this thread sets abandoned, no worker has the asset anymore.
+        if (asset->abandoned) destroy(asset);
+        else upload(asset);
+
+        if (CpuProfiler::now() - start >= limit) return;
+    }
+}
+
+void AssetManager::finish() {
+    while (asset_in_flight > 0) {
+        {
+            std::unique_lock<std::mutex> lock(asset_mutex);
+            asset_decoded_ready.wait(lock, [] { return !asset_decoded.empty(); });
+        }
+        AssetManager::update(1e9);
+    }
+}
+
+AssetState AssetManager::getState(AssetHandle handle) {
+    Asset* asset = resolve(handle);
+    return asset ? asset->state : ASSET_FAILED;
+}
+
+_RawModel* AssetManager::getModel(AssetHandle handle) {
+    Asset* asset = resolve(handle);
+    return asset ? asset->model : NULL;
+}
+
+GLuint AssetManager::getTexture(AssetHandle handle) {
+    Asset* asset = resolve(handle);
+    return (asset && asset->texture != GL_NONE) ? asset->texture : asset_placeholder_texture;
+}
@@ -0,0 +1,62 @@
+/**
+* Description: Asset manager. Models and textures are requested by path and
+* come back as handles right away. Files are read and decoded on worker
+* threads, then uploaded on the GL thread by update, within a time budget per
+* frame. Lookups return a placeholder until an asset is ready. Textures are
+* cooked on the workers, see texture_cooker.h, and kept next to the BMP, then
+* staged in the UploadRing so their upload doesn't stall the frame.
+*/
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+
+// Threads reading and decoding files.
+#define ASSET_WORKER_COUNT 2
+
+// Milliseconds per frame spent uploading decoded assets. Every update
+// uploads at least one, so loading always makes progress.
+#define ASSET_UPLOAD_BUDGET 2.0
+
+// Never returned for an asset, safe to release.
+#define ASSET_INVALID 0
+
+// Index of the asset in the low bits, generation of its slot in the high
+// ones, so handles to freed assets stop resolving.
+typedef unsigned int AssetHandle;
+
+enum AssetState { ASSET_LOADING, ASSET_READY, ASSET_FAILED };
+
+class _RawModel;
+
+class AssetManager {
+public:
+    // Start the workers and create the placeholders. Needs the GL context.
+    static void initialize();
+    // Wait for the workers and free every asset.
+    static void shutdown();
+
+    // Request a model (OBJ, size as in RawModelInfo) or a BMP texture, which
+    // is uploaded block compressed with its mips. The same path returns the
+    // same handle, with one more reference.
+    static AssetHandle loadModel(const std::string& path, glm::vec3 size);
+    static AssetHandle loadTexture(const std::string& path);
+
+    // Take and drop references. The asset is freed with the last one.
+    static void acquire(AssetHandle handle);
+    static void release(AssetHandle handle);
+
+    // Upload decoded assets for up to budget milliseconds. Call once per
+    // frame, on the GL thread.
+    static void update(double budget);
+    // Block until every requested asset is ready or failed.
+    static void finish();
+
+    static AssetState getState(AssetHandle handle);
+    // The model, or NULL while it is not ready.
+    static _RawModel* getModel(AssetHandle handle);
+    // The texture, or a grey placeholder while it is not ready.
+    static GLuint getTexture(AssetHandle handle);
+};
@@ -0,0 +1,107 @@
+/**
+* Description: Deterministic benchmark. Flies a scripted camera path over a
+* seeded world, spawning lights on a fixed schedule, and writes frame time
+* statistics and GPU pass timings to JSON.
+*/
+
+#include "benchmark.h"
+#include <GL/glew.h>
+#include <stdio.h>
+#include <algorithm>
+
+Benchmark::Benchmark(int frames) {
+    this->frames = frames;
+    this->frame = 0;
+    this->cpu_times.reserve(frames);
+    this->frame_times.reserve(frames);
+}
+
+Benchmark::~Benchmark() {}
+
+// Fly forward along -z, weaving left and right and turning into the weave,
+// looking slightly down at the terrain.
+void Benchmark::getCameraPose(glm::vec3* translation, glm::vec3* rotation) {
+    const float two_pi = 6.2831853f;
+    float t = this->frame * BENCHMARK_TIME_STEP;
+    float phase = two_pi * t / BENCHMARK_WEAVE_PERIOD;
+
+    *translation = glm::vec3(
+        BENCHMARK_WEAVE_RADIUS * sinf(phase),
+        BENCHMARK_ALTITUDE + 0.25f * BENCHMARK_ALTITUDE * sinf(phase * 0.5f),
+        -BENCHMARK_CAMERA_SPEED * t);
+
+    // Heading follows the path's sideways velocity.
+    float sideways = BENCHMARK_WEAVE_RADIUS * two_pi / BENCHMARK_WEAVE_PERIOD *
+        cosf(phase);
+    *rotation = glm::vec3(-0.25f, -atanf(sideways / BENCHMARK_CAMERA_SPEED), 0);
+}
+
+void Benchmark::updateLights(LightSystem* light_system, glm::vec3 position) {
+    if (this->frame % BENCHMARK_LIGHT_INTERVAL == 0) {
+        light_system->addLight(position);
+    }
+    if (this->frame > 0 && this->frame % BENCHMARK_TYPE_INTERVAL == 0) {
+        light_system->switchType();
+    }
+}
+
+bool Benchmark::recordFrame(float cpu_time, float frame_time) {
+    if (this->frame >= BENCHMARK_WARMUP_FRAMES) {
+        this->cpu_times.push_back(cpu_time);
+        this->frame_times.push_back(frame_time);
+    }
+
+    return ++this->frame < this->frames;
+}
+
+// Min, mean, percentiles and max of a series, in milliseconds.
+static void writeSeries(FILE* file, const char* name, std::vector<float> times) {
+    if (times.empty()) {
+        fprintf(file, "  \"%s\": null,\n", name);
+        return;
+    }
+
+    std::sort(times.begin(), times.end());
+    size_t last = times.size() - 1;
+    double sum = 0;
+    for (size_t i = 0; i < times.size(); i++) sum += times[i];
+
+    fprintf(file, "  \"%s\": { \"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, "
+        "\"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n", name,
+        times[0] * 1000, sum / times.size() * 1000, times[last * 50 / 100] * 1000,
+        times[last * 95 / 100] * 1000, times[last * 99 / 100] * 1000,
+        times[last] * 1000);
+}
+
+bool Benchmark::writeResults(const char* path, GpuProfiler* gpu) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not write the benchmark results to %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"renderer\": \"%s\",\n", (const char*)glGetString(GL_RENDERER));
+    fprintf(file, "  \"version\": \"%s\",\n", (const char*)glGetString(GL_VERSION));
+    fprintf(file, "  \"seed\": %d,\n", BENCHMARK_SEED);
+    fprintf(file, "  \"frames\": %d,\n", this->frame);
+    fprintf(file, "  \"warmup_frames\": %d,\n", BENCHMARK_WARMUP_FRAMES);
+    writeSeries(file, "frame_ms", this->frame_times);
+    writeSeries(file, "cpu_ms", this->cpu_times);
+
+    // GPU passes over the profiler's recent history.
+    fprintf(file, "  \"gpu_ms\": {");
+    for (int pass = 0; pass <= GPU_PASS_COUNT; pass++) {
+        float min, mean, p99;
+        if (!gpu->getStatistics(pass, &min, &mean, &p99)) break;
+
+        fprintf(file, "%s\n    \"%s\": { \"min\": %.4f, \"mean\": %.4f, \"p99\": %.4f }",
+            pass > 0 ? "," : "", GpuProfiler::getPassName(pass),
+            min * 1000, mean * 1000, p99 * 1000);
+    }
+    fprintf(file, "\n  }\n}\n");
+    fclose(file);
+
+    printf("Benchmark results written to %s\n", path);
+    return true;
+}
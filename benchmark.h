@@ -0,0 +1,61 @@
+/**
+* Description: Deterministic benchmark. Flies a scripted camera path over a
+* seeded world, spawning lights on a fixed schedule, and writes frame time
+* statistics and GPU pass timings to JSON.
+*/
+
+#pragma once
+
+#include "glm\glm.hpp"
+#include "light_system.h"
+#include "gpu_profiler.h"
+#include <vector>
+
+// Seed for the terrain and the lights.
+#define BENCHMARK_SEED 1337
+
+// Frames rendered, the first BENCHMARK_WARMUP_FRAMES are not measured
+// (shader and texture residency, sky bake).
+#define BENCHMARK_FRAMES 1800
+#define BENCHMARK_WARMUP_FRAMES 60
+
+// Simulated time per frame, in seconds, so the path and the light movement
+// don't depend on how fast the machine renders.
+#define BENCHMARK_TIME_STEP (1.0f / 90.0f)
+
+// Camera path: forward speed, weave amplitude and period, altitude.
+#define BENCHMARK_CAMERA_SPEED 400.0f
+#define BENCHMARK_WEAVE_RADIUS 600.0f
+#define BENCHMARK_WEAVE_PERIOD 12.0f
+#define BENCHMARK_ALTITUDE 450.0f
+
+// A light is spawned every BENCHMARK_LIGHT_INTERVAL frames, and the light
+// type switches every BENCHMARK_TYPE_INTERVAL frames.
+#define BENCHMARK_LIGHT_INTERVAL 20
+#define BENCHMARK_TYPE_INTERVAL 600
+
+#define BENCHMARK_OUTPUT "benchmark.json"
+
+class Benchmark {
+public:
+    Benchmark(int frames);
+    ~Benchmark();
+
+    // Camera pose for the current frame.
+    void getCameraPose(glm::vec3* translation, glm::vec3* rotation);
+
+    // Apply the light schedule for the current frame.
+    void updateLights(LightSystem* light_system, glm::vec3 position);
+
+    // Record the current frame's times (seconds) and move to the next one.
+    // Returns false once every frame has been rendered.
+    bool recordFrame(float cpu_time, float frame_time);
+
+    bool writeResults(const char* path, GpuProfiler* gpu);
+
+private:
+    int frames;
+    int frame;
+    std::vector<float> cpu_times;
+    std::vector<float> frame_times;
+};
@@ -0,0 +1,339 @@
+/**
+* Description: Microbenchmarks for the CPU hot paths: terrain block setup,
+* fractal generation and normals, OBJ and BMP loading, texture cooking and
+* light movement and selection.
+* Nothing here creates a GL context, the inputs are synthetic files written
+* next to the executable and removed afterwards.
+*
+* Build as its own executable, with the repository root on the include path,
+* together with world.cpp, light_system.cpp, light_grid.cpp, raw_model.cpp,
+* entity.cpp, camera.cpp, mesh_loader.cpp, mesh_simplifier.cpp,
+* mesh_meshlet.cpp, mesh_file.cpp, mapped_file.cpp, asset_manager.cpp,
+* texture_loader.cpp, texture_cooker.cpp, texture_file.cpp, upload_ring.cpp,
+* gl_state.cpp and cpu_profiler.cpp, linking GLEW and GLFW (only for their
+* symbols).
+*
+* Usage: micro_benchmark [--quick] [output.json]
+* --quick stops each size range one step early, for a smoke run.
+*/
+
+#include "minimalOpenGL.h"
+#include "world.h"
+#include "light_system.h"
+#include "camera.h"
+#include "mesh_loader.h"
+#include "texture_loader.h"
+#include "texture_cooker.h"
+#include <chrono>
+#include <cstdint>
+
+#define MICRO_BENCHMARK_OUTPUT "micro_benchmark.json"
+
+// Every case is repeated at least MIN_RUNS times, and then until it has run
+// for TIME_BUDGET seconds or MAX_RUNS times.
+#define MICRO_BENCHMARK_MIN_RUNS 3
+#define MICRO_BENCHMARK_MAX_RUNS 50
+#define MICRO_BENCHMARK_TIME_BUDGET 1.0
+
+// Light movement is too quick to time a single step, steps are timed in
+// batches of this size.
+#define MICRO_BENCHMARK_LIGHT_STEPS 1000
+
+#define MICRO_BENCHMARK_SEED 1337
+
+// Size ranges. Grid sizes are squares per block side (powers of two, for the
+// fractal), faces are OBJ triangles, textures are pixels per side.
+static const unsigned int grid_sizes[] = { 64, 256, 1024, 4096 };
+static const unsigned int face_counts[] = { 10000, 100000, 1000000, 10000000 };
+static const unsigned int texture_sizes[] = { 256, 1024, 4096 };
+static const unsigned int light_counts[] = { 10, 100, 1000, 10000, 100000 };
+
+#define COUNT_OF(array) (sizeof(array) / sizeof(array[0]))
+
+struct MicroBenchmarkResult {
+    std::string name;
+    unsigned int size;
+    unsigned int runs;
+    double min, median, mean;
+};
+
+static std::vector<MicroBenchmarkResult> results;
+
+static double now() {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Times body, running setup and teardown around every run outside of the
+// measurement, and records the statistics in milliseconds.
+template <typename Setup, typename Body, typename Teardown>
+static void measure(const char* name, unsigned int size, Setup setup,
+    Body body, Teardown teardown) {
+    std::vector<double> times;
+    double spent = 0;
+
+    while (times.size() < MICRO_BENCHMARK_MIN_RUNS ||
+        (spent < MICRO_BENCHMARK_TIME_BUDGET * 1000.0 &&
+        times.size() < MICRO_BENCHMARK_MAX_RUNS)) {
+        setup();
+        double start = now();
+        body();
+        double time = now() - start;
+        teardown();
+
+        times.push_back(time);
+        spent += time;
+    }
+
+    std::sort(times.begin(), times.end());
+
+    MicroBenchmarkResult result;
+    result.name = name;
+    result.size = size;
+    result.runs = (unsigned int)times.size();
+    result.min = times[0];
+    result.median = times[times.size() / 2];
+    result.mean = spent / times.size();
+    results.push_back(result);
+
+    printf("%-24s %10u %6u runs  min %10.3f ms  median %10.3f ms  mean %10.3f ms\n",
+        name, size, result.runs, result.min, result.median, result.mean);
+}
+
+template <typename Body>
+static void measure(const char* name, unsigned int size, Body body) {
+    measure(name, size, [] {}, body, [] {});
+}
+
+static void benchmarkWorld(unsigned int count) {
+    World* world = new World(glm::vec3(0, 0, 0), 1000.0f);
+
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int squares = grid_sizes[i];
+        unsigned int iterations = (unsigned int)log2(squares);
+
+        measure("World::initializeBlock", squares,
+            [] {},
+            [&] { world->initializeBlock(WORLD_MODE_FRACTAL, squares); },
+            [&] { world->releaseBlock(WORLD_MODE_FRACTAL); });
+
+        measure("World::generateFractal", squares,
+            [&] { world->initializeBlock(WORLD_MODE_FRACTAL, squares); },
+            [&] { world->generateFractal(WORLD_MODE_FRACTAL, iterations); },
+            [&] { world->releaseBlock(WORLD_MODE_FRACTAL); });
+
+        measure("World::computeNormals", squares,
+            [&] {
+                world->initializeBlock(WORLD_MODE_FRACTAL, squares);
+                world->generateFractal(WORLD_MODE_FRACTAL, iterations);
+            },
+            [&] { world->computeNormals(WORLD_MODE_FRACTAL); },
+            [&] { world->releaseBlock(WORLD_MODE_FRACTAL); });
+    }
+
+    delete world;
+}
+
+// Writes a square grid of about faces triangles, with positions, texture
+// coordinates and normals, the way exporters usually write meshes.
+static void writeObj(const std::string& path, unsigned int faces) {
+    unsigned int side = glm::max(1u, (unsigned int)sqrt(faces / 2.0));
+    unsigned int vertex_count = side + 1;
+    FILE* file = fopen(path.c_str(), "w");
+    unsigned int i, j;
+
+    for (i = 0; i < vertex_count; i++) {
+        for (j = 0; j < vertex_count; j++) {
+            float x = (float)j / side, z = (float)i / side;
+            fprintf(file, "v %f %f %f\n", x, sinf(x * 12.0f) * cosf(z * 9.0f), z);
+            fprintf(file, "vt %f %f\n", x, z);
+            fprintf(file, "vn %f %f %f\n", 0.0f, 1.0f, 0.0f);
+        }
+    }
+
+    for (i = 0; i < side; i++) {
+        for (j = 0; j < side; j++) {
+            unsigned int a = i * vertex_count + j + 1, b = a + 1;
+            unsigned int c = a + vertex_count, d = c + 1;
+
+            fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, c, c, c, b, b, b);
+            fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", b, b, b, c, c, c, d, d, d);
+        }
+    }
+
+    fclose(file);
+}
+
+static void benchmarkObj(unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        std::string path = "micro_benchmark_mesh.obj";
+        std::vector<mesh::VertexFormat> vertices;
+        std::vector<unsigned int> indices;
+
+        writeObj(path, face_counts[i]);
+
+        measure("mesh::_loadObjFile", face_counts[i],
+            [&] { vertices.clear(); indices.clear(); },
+            [&] { mesh::_loadObjFile(path, vertices, indices); },
+            [] {});
+
+        remove(path.c_str());
+    }
+}
+
+// Writes an uncompressed 24 or 32 bit BMP with a gradient.
+static void writeBmp(const std::string& path, unsigned int size, unsigned int bits) {
+    unsigned int channels = bits / 8;
+    unsigned int row = (size * channels + 3) & ~3u;
+    std::uint32_t data_size = row * size;
+    std::uint8_t header[54] = { 'B', 'M' };
+    std::vector<std::uint8_t> data(data_size);
+    FILE* file = fopen(path.c_str(), "wb");
+
+    // File header followed by the BITMAPINFOHEADER, little endian.
+    auto put = [&](unsigned int offset, std::uint32_t value, unsigned int bytes) {
+        for (unsigned int b = 0; b < bytes; b++)
+            header[offset + b] = (std::uint8_t)(value >> (8 * b));
+    };
+    put(2, 54 + data_size, 4);
+    put(10, 54, 4);
+    put(14, 40, 4);
+    put(18, size, 4);
+    put(22, size, 4);
+    put(26, 1, 2);
+    put(28, bits, 2);
+    put(34, data_size, 4);
+
+    for (unsigned int y = 0; y < size; y++) {
+        for (unsigned int x = 0; x < size; x++) {
+            std::uint8_t* pixel = &data[y * row + x * channels];
+            pixel[0] = (std::uint8_t)x;
+            pixel[1] = (std::uint8_t)y;
+            pixel[2] = (std::uint8_t)(x ^ y);
+            if (channels == 4) pixel[3] = 255;
+        }
+    }
+
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+}
+
+static void benchmarkBmp(unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        std::string path = "micro_benchmark_texture.bmp";
+        unsigned int size = texture_sizes[i];
+
+        writeBmp(path, size, 24);
+        measure("loadBMP 24 bit", size, [&] {
+            int width, height, channels;
+            std::vector<std::uint8_t> data;
+            loadBMP(path, width, height, channels, data);
+        });
+
+        writeBmp(path, size, 32);
+        measure("loadBMP 32 bit", size, [&] {
+            int width, height, channels;
+            std::vector<std::uint8_t> data;
+            loadBMP(path, width, height, channels, data);
+        });
+
+        // Mips and block compression, from the decoded 32 bit image.
+        int width, height, channels;
+        std::vector<std::uint8_t> pixels;
+        loadBMP(path, width, height, channels, pixels);
+        measure("texture::_cookTexture mips", size, [&] {
+            texture::TextureData texture;
+            texture::_cookTexture(pixels, width, height, channels, false, texture);
+        });
+        measure("texture::_cookTexture BC3", size, [&] {
+            texture::TextureData texture;
+            texture::_cookTexture(pixels, width, height, channels, true, texture);
+        });
+
+        remove(path.c_str());
+    }
+}
+
+// Light counts above LIGHT_MAXIMUM_COUNT are skipped, the system can't hold
+// them.
+static void benchmarkLights(unsigned int count) {
+    Camera* camera = new Camera();
+    glm::vec3 position = glm::vec3(0, 0, 0);
+
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int lights = light_counts[i];
+
+        if (lights > LIGHT_MAXIMUM_COUNT) {
+            printf("%-24s %10u skipped, over LIGHT_MAXIMUM_COUNT (%d)\n",
+                "LightSystem::move", lights, LIGHT_MAXIMUM_COUNT);
+            continue;
+        }
+
+        LightSystem* light_system = new LightSystem(LIGHT_OMNI, camera);
+        light_system->setSeed(MICRO_BENCHMARK_SEED);
+        for (unsigned int j = 0; j < lights; j++) {
+            light_system->addLight(position + glm::vec3(
+                (float)(j % 10) * 50.0f, 0, (float)(j / 10) * 50.0f));
+        }
+
+        measure("LightSystem::move", lights, [&] {
+            for (unsigned int step = 0; step < MICRO_BENCHMARK_LIGHT_STEPS; step++)
+                light_system->move(1.0f / 90.0f, position, 20.0f);
+        });
+
+        measure("LightSystem::selectLights", lights, [&] {
+            for (unsigned int step = 0; step < MICRO_BENCHMARK_LIGHT_STEPS; step++)
+                light_system->selectLights(position);
+        });
+
+        delete light_system;
+    }
+
+    delete camera;
+}
+
+static void writeResults(const char* path) {
+    FILE* file = fopen(path, "w");
+
+    if (!file) {
+        printf("Micro benchmark: could not write %s\n", path);
+        return;
+    }
+
+    fprintf(file, "{\n  \"light_steps_per_run\": %d,\n  \"results\": [\n",
+        MICRO_BENCHMARK_LIGHT_STEPS);
+    for (unsigned int i = 0; i < results.size(); i++) {
+        MicroBenchmarkResult& result = results[i];
+
+        fprintf(file, "    { \"name\": \"%s\", \"size\": %u, \"runs\": %u, "
+            "\"min_ms\": %.4f, \"median_ms\": %.4f, \"mean_ms\": %.4f }%s\n",
+            result.name.c_str(), result.size, result.runs, result.min,
+            result.median, result.mean, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+
+    printf("Micro benchmark results written to %s\n", path);
+}
+
+int main(int argc, char** argv) {
+    const char* output = MICRO_BENCHMARK_OUTPUT;
+    bool quick = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) quick = true;
+        else output = argv[i];
+    }
+
+    World::setSeed(MICRO_BENCHMARK_SEED);
+
+    benchmarkWorld(COUNT_OF(grid_sizes) - quick);
+    benchmarkObj(COUNT_OF(face_counts) - quick);
+    benchmarkBmp(COUNT_OF(texture_sizes) - quick);
+    benchmarkLights(COUNT_OF(light_counts) - quick);
+
+    writeResults(output);
+
+    return 0;
+}
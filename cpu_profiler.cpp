@@ -0,0 +1,174 @@
+/**
+* Description: CPU frame profiler. Scoped zones are recorded into a ring
+* buffer per thread, without locking, and summarized per zone as percentiles
+* or exported as a Chrome trace (chrome://tracing, Perfetto).
+*/
+
+#include "cpu_profiler.h"
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct CpuProfilerEvent {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+    unsigned int thread;
+    int depth;
+};
+
+// A thread's ring. Only its thread writes to it. When the thread exits the
+// ring goes back to the pool with its events, for the next thread to carry
+// on, so short lived worker threads don't each allocate a new one.
+struct CpuProfilerBuffer {
+    CpuProfilerEvent events[CPU_PROFILER_EVENTS_PER_THREAD];
+    std::atomic<uint64_t> count;
+    bool in_use;
+};
+
+static const std::chrono::steady_clock::time_point cpu_profiler_epoch =
+    std::chrono::steady_clock::now();
+
+static std::mutex cpu_profiler_mutex;
+static std::vector<CpuProfilerBuffer*> cpu_profiler_buffers;
+static unsigned int cpu_profiler_thread_count = 0;
+
+// Per thread state, registering the ring on first use.
+struct CpuProfilerThread {
+    CpuProfilerBuffer* buffer;
+    unsigned int id;
+    int depth;
+
+    CpuProfilerThread() {
+        std::lock_guard<std::mutex> lock(cpu_profiler_mutex);
+
+        this->buffer = NULL;
+        this->id = cpu_profiler_thread_count++;
+        this->depth = 0;
+
+        for (size_t i = 0; i < cpu_profiler_buffers.size(); i++) {
+            if (!cpu_profiler_buffers[i]->in_use) {
+                this->buffer = cpu_profiler_buffers[i];
+                break;
+            }
+        }
+
+        if (!this->buffer) {
+            this->buffer = new CpuProfilerBuffer();
+            this->buffer->count = 0;
+            cpu_profiler_buffers.push_back(this->buffer);
+        }
+        this->buffer->in_use = true;
+    }
+
+    ~CpuProfilerThread() {
+        std::lock_guard<std::mutex> lock(cpu_profiler_mutex);
+        this->buffer->in_use = false;
+    }
+};
+
+static thread_local CpuProfilerThread cpu_profiler_thread;
+
+uint64_t CpuProfiler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - cpu_profiler_epoch).count();
+}
+
+void CpuProfiler::record(const char* name, uint64_t start, uint64_t end,
+    int depth) {
+    CpuProfilerBuffer* buffer = cpu_profiler_thread.buffer;
+    uint64_t count = buffer->count.load(std::memory_order_relaxed);
+
+    CpuProfilerEvent* event =
+        &buffer->events[count % CPU_PROFILER_EVENTS_PER_THREAD];
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    event->thread = cpu_profiler_thread.id;
+    event->depth = depth;
+
+    // Publish the event to readers on other threads.
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+// Copy the recorded events out of every ring. A ring being written meanwhile
+// may have its oldest event replaced while it is copied, which only skews
+// that one sample.
+static std::vector<CpuProfilerEvent> collectEvents() {
+    std::vector<CpuProfilerEvent> events;
+    std::lock_guard<std::mutex> lock(cpu_profiler_mutex);
+
+    for (size_t i = 0; i < cpu_profiler_buffers.size(); i++) {
+        CpuProfilerBuffer* buffer = cpu_profiler_buffers[i];
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t first = count > CPU_PROFILER_EVENTS_PER_THREAD ?
+            count - CPU_PROFILER_EVENTS_PER_THREAD : 0;
+
+        for (uint64_t k = first; k < count; k++) {
+            events.push_back(buffer->events[k % CPU_PROFILER_EVENTS_PER_THREAD]);
+        }
+    }
+
+    return events;
+}
+
+void CpuProfiler::printStatistics() {
+    std::vector<CpuProfilerEvent> events = collectEvents();
+    std::map<std::string, std::vector<float> > zones;
+
+    for (size_t i = 0; i < events.size(); i++) {
+        zones[events[i].name].push_back((events[i].end - events[i].start) * 1e-6f);
+    }
+
+    printf("CPU ms (p50/p95/p99):");
+    for (std::map<std::string, std::vector<float> >::iterator zone = zones.begin();
+        zone != zones.end(); ++zone) {
+        std::vector<float>& times = zone->second;
+        std::sort(times.begin(), times.end());
+
+        size_t last = times.size() - 1;
+        printf(" %s %.2f/%.2f/%.2f", zone->first.c_str(), times[last * 50 / 100],
+            times[last * 95 / 100], times[last * 99 / 100]);
+    }
+    printf("\n");
+}
+
+// Complete ("X") events, timestamps in microseconds.
+bool CpuProfiler::exportChromeTrace(const char* path) {
+    std::vector<CpuProfilerEvent> events = collectEvents();
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not write the profile to %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < events.size(); i++) {
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f}%s\n", events[i].name, events[i].thread,
+            events[i].start * 1e-3, (events[i].end - events[i].start) * 1e-3,
+            i + 1 < events.size() ? "," : "");
+    }
+    fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+
+    printf("Profile written to %s (%u zones)\n", path, (unsigned int)events.size());
+    return true;
+}
+
+CpuProfileZone::CpuProfileZone(const char* name) {
+    this->name = name;
+    this->start = CpuProfiler::now();
+    cpu_profiler_thread.depth++;
+}
+
+CpuProfileZone::~CpuProfileZone() {
+    int depth = --cpu_profiler_thread.depth;
+    CpuProfiler::record(this->name, this->start, CpuProfiler::now(), depth);
+}
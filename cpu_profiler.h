@@ -0,0 +1,43 @@
+/**
+* Description: CPU frame profiler. Scoped zones are recorded into a ring
+* buffer per thread, without locking, and summarized per zone as percentiles
+* or exported as a Chrome trace (chrome://tracing, Perfetto).
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Zones kept per thread. The oldest are overwritten first.
+#define CPU_PROFILER_EVENTS_PER_THREAD 16384
+
+// Written by the export key and on exit, relative to the working directory.
+#define CPU_PROFILER_TRACE_FILE "profile_trace.json"
+
+class CpuProfiler {
+public:
+    // Nanoseconds since the profiler started, from std::chrono::steady_clock.
+    static uint64_t now();
+
+    // Store a finished zone for the calling thread. Zone names must be
+    // string literals, only the pointer is kept.
+    static void record(const char* name, uint64_t start, uint64_t end,
+        int depth);
+
+    // Print p50, p95 and p99 per zone over the recorded zones, in ms.
+    static void printStatistics();
+
+    // Write every recorded zone in the Chrome trace event format.
+    static bool exportChromeTrace(const char* path);
+};
+
+// Times a scope, from construction to destruction.
+class CpuProfileZone {
+public:
+    CpuProfileZone(const char* name);
+    ~CpuProfileZone();
+
+private:
+    const char* name;
+    uint64_t start;
+};
@@ -0,0 +1,6 @@
+#version 410 // -*- c++ -*-
+
+// Depth-only pre-pass, color writes are masked off.
+
+void main(){
+}
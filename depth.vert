@@ -0,0 +1,27 @@
+#version 410 // -*- c++ -*-
+
+// Depth-only pre-pass. The position transform must match min.vert exactly,
+// so the color pass can test against this depth with GL_EQUAL.
+
+// Attributes, the packed position as in min.vert.
+layout(location=6) in vec3 position;
+
+// Mesh bounds, decoding the packed position.
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
+// Uniforms
+uniform Uniform {
+    mat3x3      objectToWorldNormalMatrix;
+    mat4x4      objectToWorldMatrix;
+    mat4x4      modelViewProjectionMatrix;
+    vec3        cameraPosition;
+} object;
+
+invariant gl_Position;
+
+void main () {
+    vec3 objectPosition = position_offset + position_scale * position;
+
+    gl_Position = object.modelViewProjectionMatrix * vec4(objectPosition, 1.0);
+}
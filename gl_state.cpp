@@ -0,0 +1,214 @@
+/**
+* Description: Redundant GL state filter. Draw code changes state through
+* GLState, which skips calls that would not change anything and counts the
+* ones that do, per subsystem.
+*/
+
+#include "gl_state.h"
+#include <stdio.h>
+
+// Cached value meaning the actual state is not known.
+#define GL_STATE_UNKNOWN 0xFFFFFFFFu
+
+static const char* GL_STATE_SCOPE_NAMES[GL_STATE_SCOPE_COUNT] = {
+    "main", "sky", "world", "models"
+};
+
+int GLState::scope = GL_STATE_SCOPE_MAIN;
+unsigned int GLState::changes[GL_STATE_SCOPE_COUNT];
+unsigned int GLState::skipped[GL_STATE_SCOPE_COUNT];
+
+GLuint GLState::depth_test = GL_STATE_UNKNOWN;
+GLuint GLState::cull_face = GL_STATE_UNKNOWN;
+GLuint GLState::depth_func = GL_STATE_UNKNOWN;
+GLuint GLState::depth_mask = GL_STATE_UNKNOWN;
+GLuint GLState::color_mask = GL_STATE_UNKNOWN;
+GLuint GLState::polygon_mode = GL_STATE_UNKNOWN;
+GLuint GLState::viewport_rect[4] = { GL_STATE_UNKNOWN, GL_STATE_UNKNOWN,
+    GL_STATE_UNKNOWN, GL_STATE_UNKNOWN };
+GLuint GLState::program = GL_STATE_UNKNOWN;
+GLuint GLState::vao = GL_STATE_UNKNOWN;
+GLuint GLState::draw_framebuffer = GL_STATE_UNKNOWN;
+GLuint GLState::read_framebuffer = GL_STATE_UNKNOWN;
+GLuint GLState::active_texture = GL_STATE_UNKNOWN;
+// Nothing is bound to the texture units of a new context.
+GLuint GLState::textures[GL_STATE_TEXTURE_UNITS][2];
+GLuint GLState::samplers[GL_STATE_TEXTURE_UNITS];
+
+// Store the new value and count the call as a change or as skipped.
+bool GLState::update(GLuint* current, GLuint value) {
+    if (*current == value) {
+        GLState::skipped[GLState::scope]++;
+        return false;
+    }
+
+    *current = value;
+    GLState::changes[GLState::scope]++;
+    return true;
+}
+
+void GLState::enable(GLenum capability, bool enabled) {
+    GLuint* current = NULL;
+    if (capability == GL_DEPTH_TEST) current = &GLState::depth_test;
+    else if (capability == GL_CULL_FACE) current = &GLState::cull_face;
+
+    if (current && !GLState::update(current, enabled)) return;
+
+    if (enabled) glEnable(capability);
+    else glDisable(capability);
+}
+
+void GLState::depthFunc(GLenum func) {
+    if (GLState::update(&GLState::depth_func, func)) glDepthFunc(func);
+}
+
+void GLState::depthMask(GLboolean mask) {
+    if (GLState::update(&GLState::depth_mask, mask)) glDepthMask(mask);
+}
+
+void GLState::colorMask(GLboolean mask) {
+    if (GLState::update(&GLState::color_mask, mask)) {
+        glColorMask(mask, mask, mask, mask);
+    }
+}
+
+void GLState::polygonMode(GLenum mode) {
+    if (GLState::update(&GLState::polygon_mode, mode)) {
+        glPolygonMode(GL_FRONT_AND_BACK, mode);
+    }
+}
+
+// A viewport counts as a single change.
+void GLState::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    GLuint* current = GLState::viewport_rect;
+    if (current[0] == (GLuint)x && current[1] == (GLuint)y &&
+        current[2] == (GLuint)width && current[3] == (GLuint)height) {
+        GLState::skipped[GLState::scope]++;
+        return;
+    }
+
+    current[0] = x; current[1] = y; current[2] = width; current[3] = height;
+    GLState::changes[GLState::scope]++;
+    glViewport(x, y, width, height);
+}
+
+void GLState::useProgram(GLuint program) {
+    if (GLState::update(&GLState::program, program)) glUseProgram(program);
+}
+
+void GLState::bindVertexArray(GLuint vao) {
+    if (GLState::update(&GLState::vao, vao)) glBindVertexArray(vao);
+}
+
+// GL_FRAMEBUFFER binds both the draw and the read framebuffer.
+void GLState::bindFramebuffer(GLenum target, GLuint framebuffer) {
+    if (target == GL_FRAMEBUFFER) {
+        if (GLState::draw_framebuffer == framebuffer &&
+            GLState::read_framebuffer == framebuffer) {
+            GLState::skipped[GLState::scope]++;
+            return;
+        }
+
+        GLState::draw_framebuffer = GLState::read_framebuffer = framebuffer;
+        GLState::changes[GLState::scope]++;
+        glBindFramebuffer(target, framebuffer);
+        return;
+    }
+
+    GLuint* current = (target == GL_DRAW_FRAMEBUFFER) ?
+        &GLState::draw_framebuffer : &GLState::read_framebuffer;
+    if (GLState::update(current, framebuffer)) {
+        glBindFramebuffer(target, framebuffer);
+    }
+}
+
+void GLState::activeTexture(GLuint unit) {
+    if (GLState::update(&GLState::active_texture, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+// Tracked texture targets, -1 for the others.
+int GLState::getTargetIndex(GLenum target) {
+    if (target == GL_TEXTURE_2D) return 0;
+    if (target == GL_TEXTURE_CUBE_MAP) return 1;
+    return -1;
+}
+
+void GLState::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+    int index = GLState::getTargetIndex(target);
+
+    if (unit < GL_STATE_TEXTURE_UNITS && index >= 0) {
+        // The unit is selected even when the binding is current, for the
+        // texture calls that may follow.
+        GLState::activeTexture(unit);
+        if (!GLState::update(&GLState::textures[unit][index], texture)) return;
+    }
+    else {
+        GLState::active_texture = GL_STATE_UNKNOWN;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        GLState::changes[GLState::scope]++;
+    }
+
+    glBindTexture(target, texture);
+}
+
+void GLState::bindSampler(GLuint unit, GLuint sampler) {
+    if (unit >= GL_STATE_TEXTURE_UNITS) {
+        GLState::changes[GLState::scope]++;
+        glBindSampler(unit, sampler);
+        return;
+    }
+
+    if (GLState::update(&GLState::samplers[unit], sampler)) {
+        glBindSampler(unit, sampler);
+    }
+}
+
+void GLState::forgetTexture(GLuint texture) {
+    for (int unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++) {
+        for (int index = 0; index < 2; index++) {
+            if (GLState::textures[unit][index] == texture) GLState::textures[unit][index] = 0;
+        }
+    }
+}
+
+void GLState::forgetVertexArray(GLuint vao) {
+    if (GLState::vao == vao) GLState::vao = 0;
+}
+
+void GLState::invalidate() {
+    GLState::depth_test = GLState::cull_face = GL_STATE_UNKNOWN;
+    GLState::depth_func = GLState::depth_mask = GL_STATE_UNKNOWN;
+    GLState::color_mask = GLState::polygon_mode = GL_STATE_UNKNOWN;
+    for (int i = 0; i < 4; i++) GLState::viewport_rect[i] = GL_STATE_UNKNOWN;
+    GLState::program = GLState::vao = GL_STATE_UNKNOWN;
+    GLState::draw_framebuffer = GLState::read_framebuffer = GL_STATE_UNKNOWN;
+    GLState::active_texture = GL_STATE_UNKNOWN;
+
+    for (int unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++) {
+        GLState::textures[unit][0] = GLState::textures[unit][1] = GL_STATE_UNKNOWN;
+        GLState::samplers[unit] = GL_STATE_UNKNOWN;
+    }
+}
+
+void GLState::setScope(int scope) { GLState::scope = scope; }
+int GLState::getScope() { return GLState::scope; }
+
+void GLState::printStatistics(int frames) {
+    printf("GL state changes per frame (skipped):");
+    for (int i = 0; i < GL_STATE_SCOPE_COUNT; i++) {
+        printf(" %s %.1f (%.1f)", GL_STATE_SCOPE_NAMES[i],
+            float(GLState::changes[i]) / frames,
+            float(GLState::skipped[i]) / frames);
+        GLState::changes[i] = GLState::skipped[i] = 0;
+    }
+    printf("\n");
+}
+
+GLStateScope::GLStateScope(int scope) {
+    this->previous = GLState::getScope();
+    GLState::setScope(scope);
+}
+
+GLStateScope::~GLStateScope() { GLState::setScope(this->previous); }
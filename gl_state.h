@@ -0,0 +1,84 @@
+/**
+* Description: Redundant GL state filter. Draw code changes state through
+* GLState, which skips calls that would not change anything and counts the
+* ones that do, per subsystem.
+*/
+
+#pragma once
+
+#include <GL/glew.h>
+
+// Subsystems state changes are attributed to.
+#define GL_STATE_SCOPE_MAIN 0
+#define GL_STATE_SCOPE_SKY 1
+#define GL_STATE_SCOPE_WORLD 2
+#define GL_STATE_SCOPE_MODELS 3
+
+#define GL_STATE_SCOPE_COUNT 4
+
+// Texture units with tracked bindings, the others are passed through.
+#define GL_STATE_TEXTURE_UNITS 8
+
+class GLState {
+public:
+    // Depth test and face culling are tracked, other capabilities are
+    // passed through.
+    static void enable(GLenum capability, bool enabled);
+    static void depthFunc(GLenum func);
+    static void depthMask(GLboolean mask);
+    // Same mask for all four channels.
+    static void colorMask(GLboolean mask);
+    // Front and back faces.
+    static void polygonMode(GLenum mode);
+    static void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    static void useProgram(GLuint program);
+    static void bindVertexArray(GLuint vao);
+    static void bindFramebuffer(GLenum target, GLuint framebuffer);
+    // Also makes the unit active, so texture calls that follow apply to it.
+    static void bindTexture(GLuint unit, GLenum target, GLuint texture);
+    static void bindSampler(GLuint unit, GLuint sampler);
+
+    // Call before deleting an object. GL unbinds it wherever it is bound, so
+    // the cached bindings go back to 0, and a name reused by the next object
+    // is not mistaken for the one already bound.
+    static void forgetTexture(GLuint texture);
+    static void forgetVertexArray(GLuint vao);
+
+    // Forget everything, after code that doesn't go through GLState changed
+    // state or object names may have been reused.
+    static void invalidate();
+
+    static void setScope(int scope);
+    static int getScope();
+
+    // Print changes and skipped calls per frame for each scope, then reset.
+    static void printStatistics(int frames);
+
+private:
+    static bool update(GLuint* current, GLuint value);
+    static void activeTexture(GLuint unit);
+    static int getTargetIndex(GLenum target);
+
+    static int scope;
+    static unsigned int changes[GL_STATE_SCOPE_COUNT];
+    static unsigned int skipped[GL_STATE_SCOPE_COUNT];
+
+    static GLuint depth_test, cull_face, depth_func, depth_mask, color_mask;
+    static GLuint polygon_mode;
+    static GLuint viewport_rect[4];
+    static GLuint program, vao, draw_framebuffer, read_framebuffer;
+    static GLuint active_texture;
+    static GLuint textures[GL_STATE_TEXTURE_UNITS][2];
+    static GLuint samplers[GL_STATE_TEXTURE_UNITS];
+};
+
+// Attributes the state changes in a block to a scope, restoring the previous
+// scope when it ends.
+class GLStateScope {
+public:
+    GLStateScope(int scope);
+    ~GLStateScope();
+
+private:
+    int previous;
+};
@@ -0,0 +1,149 @@
+/**
+* Description: GPU pass profiler. Timestamp queries around each render pass
+* are kept in a ring a few frames deep and read back once the GPU is done with
+* them, so measuring never stalls the pipeline.
+*/
+
+#include "gpu_profiler.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+static const char* GPU_PASS_NAMES[GPU_PASS_COUNT + 1] = {
+    "sky", "depth", "lights", "terrain", "blit", "frame"
+};
+
+// Timestamps (not GL_TIME_ELAPSED) so passes may nest inside the frame.
+GpuProfiler::GpuProfiler() {
+    glGenQueries(sizeof(this->queries) / sizeof(this->queries[0]), this->queries);
+    this->next_query = 0;
+
+    memset(this->frames, 0, sizeof(this->frames));
+    memset(this->history, 0, sizeof(this->history));
+    this->current = 0;
+    this->history_count = 0;
+    this->dropped = 0;
+    this->frame_time = 0;
+
+    for (int i = 0; i < GPU_PASS_COUNT; i++) this->open_run[i] = -1;
+}
+
+GpuProfiler::~GpuProfiler() {
+    glDeleteQueries(sizeof(this->queries) / sizeof(this->queries[0]), this->queries);
+}
+
+// Each frame slot owns a fixed share of the query pool, which is only reused
+// once the slot has been read back or dropped.
+GLuint GpuProfiler::getQuery() {
+    return this->queries[this->next_query++];
+}
+
+// Read back the oldest frame of the ring, if the GPU got through it, and
+// start recording into its slot.
+void GpuProfiler::beginFrame() {
+    this->current = (this->current + 1) % GPU_PROFILER_LATENCY;
+    Frame* frame = &this->frames[this->current];
+
+    if (frame->pending) {
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(frame->end, GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (available) this->readBack(frame);
+        else this->dropped++;
+    }
+
+    this->next_query = this->current * (GPU_PROFILER_MAX_RUNS + 1) * 2;
+    frame->run_count = 0;
+    frame->pending = false;
+    frame->start = this->getQuery();
+    frame->end = this->getQuery();
+    glQueryCounter(frame->start, GL_TIMESTAMP);
+}
+
+void GpuProfiler::endFrame() {
+    Frame* frame = &this->frames[this->current];
+
+    glQueryCounter(frame->end, GL_TIMESTAMP);
+    frame->pending = true;
+}
+
+// Runs past GPU_PROFILER_MAX_RUNS in a frame are not timed.
+void GpuProfiler::begin(int pass) {
+    Frame* frame = &this->frames[this->current];
+    if (frame->run_count == GPU_PROFILER_MAX_RUNS) return;
+
+    Run* run = &frame->runs[frame->run_count];
+    run->pass = pass;
+    run->start = this->getQuery();
+    run->end = this->getQuery();
+    glQueryCounter(run->start, GL_TIMESTAMP);
+
+    this->open_run[pass] = frame->run_count++;
+}
+
+void GpuProfiler::end(int pass) {
+    if (this->open_run[pass] < 0) return;
+
+    Frame* frame = &this->frames[this->current];
+    glQueryCounter(frame->runs[this->open_run[pass]].end, GL_TIMESTAMP);
+    this->open_run[pass] = -1;
+}
+
+float GpuProfiler::getFrameTime() { return this->frame_time; }
+
+// The frame end timestamp is the last query of the frame, so everything
+// before it is available too and none of these calls wait.
+void GpuProfiler::readBack(Frame* frame) {
+    float pass_times[GPU_PASS_COUNT] = { 0 };
+    GLuint64 start, end;
+
+    for (int i = 0; i < frame->run_count; i++) {
+        glGetQueryObjectui64v(frame->runs[i].start, GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(frame->runs[i].end, GL_QUERY_RESULT, &end);
+        pass_times[frame->runs[i].pass] += float(end - start) * 1e-9f;
+    }
+
+    glGetQueryObjectui64v(frame->start, GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(frame->end, GL_QUERY_RESULT, &end);
+    this->frame_time = float(end - start) * 1e-9f;
+
+    int slot = this->history_count++ % GPU_PROFILER_HISTORY;
+    for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+        this->history[pass][slot] = pass_times[pass];
+    }
+    this->history[GPU_PASS_COUNT][slot] = this->frame_time;
+}
+
+bool GpuProfiler::getStatistics(int pass, float* min, float* mean, float* p99) {
+    int count = std::min(this->history_count, GPU_PROFILER_HISTORY);
+    if (count == 0) return false;
+
+    float sorted[GPU_PROFILER_HISTORY];
+    float sum = 0;
+
+    memcpy(sorted, this->history[pass], count * sizeof(float));
+    std::sort(sorted, sorted + count);
+    for (int i = 0; i < count; i++) sum += sorted[i];
+
+    *min = sorted[0];
+    *mean = sum / count;
+    *p99 = sorted[(count - 1) * 99 / 100];
+    return true;
+}
+
+const char* GpuProfiler::getPassName(int pass) { return GPU_PASS_NAMES[pass]; }
+
+void GpuProfiler::printStatistics() {
+    float min, mean, p99;
+    if (!this->getStatistics(GPU_PASS_COUNT, &min, &mean, &p99)) return;
+
+    printf("GPU ms (min/mean/p99):");
+    for (int pass = 0; pass <= GPU_PASS_COUNT; pass++) {
+        this->getStatistics(pass, &min, &mean, &p99);
+        printf(" %s %.2f/%.2f/%.2f", GPU_PASS_NAMES[pass], min * 1000,
+            mean * 1000, p99 * 1000);
+    }
+
+    if (this->dropped > 0) printf(", %d frames dropped", this->dropped);
+    printf("\n");
+}
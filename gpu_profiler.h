@@ -0,0 +1,82 @@
+/**
+* Description: GPU pass profiler. Timestamp queries around each render pass
+* are kept in a ring a few frames deep and read back once the GPU is done with
+* them, so measuring never stalls the pipeline.
+*/
+
+#pragma once
+
+#include <GL/glew.h>
+
+// Timed render passes. A pass can run several times a frame (once per eye),
+// its times are added up.
+#define GPU_PASS_SKY 0
+#define GPU_PASS_DEPTH 1
+#define GPU_PASS_LIGHTS 2
+#define GPU_PASS_TERRAIN 3
+#define GPU_PASS_BLIT 4
+
+#define GPU_PASS_COUNT 5
+
+// Frames in flight before a frame's queries are read back. Results still not
+// available by then are dropped rather than waited for.
+#define GPU_PROFILER_LATENCY 4
+
+// Timed pass runs per frame.
+#define GPU_PROFILER_MAX_RUNS 32
+
+// Frames of history behind the statistics.
+#define GPU_PROFILER_HISTORY 128
+
+class GpuProfiler {
+public:
+    GpuProfiler();
+    ~GpuProfiler();
+
+    // Bracket everything drawn for a frame, and each pass within it.
+    void beginFrame();
+    void endFrame();
+    void begin(int pass);
+    void end(int pass);
+
+    // GPU time of the last frame read back, in seconds. Lags a few frames
+    // behind, 0 until the first result arrives.
+    float getFrameTime();
+
+    // Min, mean and p99 of a pass over the history, in seconds. GPU_PASS_COUNT
+    // stands for the whole frame. Returns false before any frame is read back.
+    bool getStatistics(int pass, float* min, float* mean, float* p99);
+    static const char* getPassName(int pass);
+
+    // Print min, mean and p99 per pass over the history, in milliseconds.
+    void printStatistics();
+
+private:
+    struct Run {
+        int pass;
+        GLuint start, end;
+    };
+
+    struct Frame {
+        GLuint start, end;
+        Run runs[GPU_PROFILER_MAX_RUNS];
+        int run_count;
+        bool pending;
+    };
+
+    GLuint getQuery();
+    void readBack(Frame* frame);
+
+    Frame frames[GPU_PROFILER_LATENCY];
+    int current;
+    int open_run[GPU_PASS_COUNT];
+
+    // Per pass, plus the whole frame at GPU_PASS_COUNT.
+    float history[GPU_PASS_COUNT + 1][GPU_PROFILER_HISTORY];
+    int history_count;
+    int dropped;
+    float frame_time;
+
+    GLuint queries[GPU_PROFILER_LATENCY * (GPU_PROFILER_MAX_RUNS + 1) * 2];
+    int next_query;
+};
@@ -0,0 +1,89 @@
+/**
+* Description: Uniform grid over the ground plane, indexing lights by
+* position. Cells are hashed, so the world needs no bounds and empty cells
+* cost nothing. Lights change cell only when they cross a cell border, and
+* queries visit only the cells a region overlaps, so their cost follows the
+* number of lights nearby instead of the total.
+*/
+
+#include "light_grid.h"
+#include <cmath>
+
+LightGrid::LightGrid(float cell_size) {
+    this->cell_size = cell_size;
+}
+
+long long LightGrid::getCell(int cell_x, int cell_z) {
+    return (long long)(((unsigned long long)(unsigned int)cell_x << 32) | (unsigned int)cell_z);
+}
+
+// Clamped, so boxes reaching past any light still convert to cells.
+int LightGrid::getCoordinate(float position) {
+    float cell = floorf(position / this->cell_size);
+    return (int)glm::clamp(cell, -1073741824.0f, 1073741824.0f);
+}
+
+void LightGrid::insert(int light, glm::vec3 position) {
+    long long cell = this->getCell(this->getCoordinate(position.x), this->getCoordinate(position.z));
+    std::vector<int>& lights = this->cells[cell];
+
+    if ((int)this->light_cells.size() <= light) {
+        this->light_cells.resize(light + 1);
+        this->light_slots.resize(light + 1);
+    }
+    this->light_cells[light] = cell;
+    this->light_slots[light] = (int)lights.size();
+    lights.push_back(light);
+}
+
+void LightGrid::update(int light, glm::vec3 position) {
+    long long cell = this->getCell(this->getCoordinate(position.x), this->getCoordinate(position.z));
+    if (cell == this->light_cells[light]) return;
+
+    // Swap the last light of the old cell into its place.
+    std::unordered_map<long long, std::vector<int> >::iterator old = this->cells.find(this->light_cells[light]);
+    std::vector<int>& lights = old->second;
+    int slot = this->light_slots[light];
+    lights[slot] = lights.back();
+    this->light_slots[lights[slot]] = slot;
+    lights.pop_back();
+    if (lights.empty()) this->cells.erase(old);
+
+    std::vector<int>& destination = this->cells[cell];
+    this->light_cells[light] = cell;
+    this->light_slots[light] = (int)destination.size();
+    destination.push_back(light);
+}
+
+void LightGrid::clear() {
+    this->cells.clear();
+    this->light_cells.clear();
+    this->light_slots.clear();
+}
+
+void LightGrid::query(glm::vec3 minimum, glm::vec3 maximum, std::vector<int>& result) {
+    int first_x = this->getCoordinate(minimum.x), last_x = this->getCoordinate(maximum.x);
+    int first_z = this->getCoordinate(minimum.z), last_z = this->getCoordinate(maximum.z);
+
+    // A box wider than the occupied cells is cheaper to answer from them.
+    double span = ((double)last_x - first_x + 1) * ((double)last_z - first_z + 1);
+    if (span > (double)this->cells.size()) {
+        std::unordered_map<long long, std::vector<int> >::iterator it;
+        for (it = this->cells.begin(); it != this->cells.end(); ++it) {
+            int cell_x = (int)(unsigned int)((unsigned long long)it->first >> 32), cell_z = (int)(unsigned int)it->first;
+            if (cell_x < first_x || cell_x > last_x || cell_z < first_z || cell_z > last_z) continue;
+            result.insert(result.end(), it->second.begin(), it->second.end());
+        }
+        return;
+    }
+
+    for (int cell_x = first_x; cell_x <= last_x; cell_x++) {
+        for (int cell_z = first_z; cell_z <= last_z; cell_z++) {
+            std::unordered_map<long long, std::vector<int> >::iterator it = this->cells.find(this->getCell(cell_x, cell_z));
+            if (it == this->cells.end()) continue;
+            result.insert(result.end(), it->second.begin(), it->second.end());
+        }
+    }
+}
+
+int LightGrid::getCellCount() { return (int)this->cells.size(); }
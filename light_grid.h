@@ -0,0 +1,44 @@
+/**
+* Description: Uniform grid over the ground plane, indexing lights by
+* position. Cells are hashed, so the world needs no bounds and empty cells
+* cost nothing. Lights change cell only when they cross a cell border, and
+* queries visit only the cells a region overlaps, so their cost follows the
+* number of lights nearby instead of the total.
+*/
+
+#pragma once
+
+#include "glm\glm.hpp"
+#include <unordered_map>
+#include <vector>
+
+// Side of a cell, in world units. Lights spread over the terrain, height is
+// not divided.
+#define LIGHT_GRID_CELL_SIZE 250.0f
+
+class LightGrid {
+public:
+    LightGrid(float cell_size);
+
+    // Add light, numbered in order from 0, at position.
+    void insert(int light, glm::vec3 position);
+    // Follow a light that moved, only touches the cells if it left its own.
+    void update(int light, glm::vec3 position);
+    void clear();
+
+    // Append the lights in every cell the box overlaps on x and z, a
+    // superset of the lights inside it.
+    void query(glm::vec3 minimum, glm::vec3 maximum, std::vector<int>& result);
+
+    int getCellCount();
+
+private:
+    long long getCell(int cell_x, int cell_z);
+    int getCoordinate(float position);
+
+    float cell_size;
+    std::unordered_map<long long, std::vector<int> > cells;
+    // Cell of each light, and its place in the cell's list
+    std::vector<long long> light_cells;
+    std::vector<int> light_slots;
+};
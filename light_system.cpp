@@ -5,55 +5,89 @@
 */
 
 #include "light_system.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || defined(__AVX2__)
+#   include <immintrin.h>
+#endif
 
-// Instantiate a simple light, with its variables.
-Light::Light(unsigned int type, glm::vec3 position, RawModelMaterial* material,
-    float size) {
-    this->position = position;
-    this->type = type;
-    this->material = material;
-    this->size = glm::vec3(size, size, size);
-}
+// Move every light within radius of target toward it by speed, over
+// positions stored one array per axis. Lights on the target stay in place.
+static void moveLightsToward(float* x, float* y, float* z, int count,
+    glm::vec3 target, float radius, float speed) {
+    const float radius_2 = radius * radius;
+    int i = 0;
 
-Light::~Light() {}
+#if defined(__AVX2__)
+    const __m256 target_x8 = _mm256_set1_ps(target.x);
+    const __m256 target_y8 = _mm256_set1_ps(target.y);
+    const __m256 target_z8 = _mm256_set1_ps(target.z);
+    const __m256 radius_8 = _mm256_set1_ps(radius_2);
+    const __m256 speed_8 = _mm256_set1_ps(speed);
+    const __m256 zero_8 = _mm256_setzero_ps();
+    for (; i + 8 <= count; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+        __m256 dx = _mm256_sub_ps(target_x8, px);
+        __m256 dy = _mm256_sub_ps(target_y8, py);
+        __m256 dz = _mm256_sub_ps(target_z8, pz);
+        __m256 distance_2 = _mm256_add_ps(_mm256_mul_ps(dx, dx),
+            _mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(dz, dz)));
 
-// Set a light's type.
-void Light::setType(unsigned int type) { this->type = type; }
+        // Lanes out of range or on the target get a step of zero.
+        __m256 moving = _mm256_and_ps(_mm256_cmp_ps(distance_2, radius_8, _CMP_LE_OQ),
+            _mm256_cmp_ps(distance_2, zero_8, _CMP_GT_OQ));
+        __m256 step = _mm256_and_ps(moving, _mm256_div_ps(speed_8, _mm256_sqrt_ps(distance_2)));
 
-// Set a light's position.
-void Light::move(glm::vec3 movement) {
-    this->position = this->position + movement;
-}
+        _mm256_storeu_ps(x + i, _mm256_add_ps(px, _mm256_mul_ps(dx, step)));
+        _mm256_storeu_ps(y + i, _mm256_add_ps(py, _mm256_mul_ps(dy, step)));
+        _mm256_storeu_ps(z + i, _mm256_add_ps(pz, _mm256_mul_ps(dz, step)));
+    }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128 target_x4 = _mm_set1_ps(target.x);
+    const __m128 target_y4 = _mm_set1_ps(target.y);
+    const __m128 target_z4 = _mm_set1_ps(target.z);
+    const __m128 radius_4 = _mm_set1_ps(radius_2);
+    const __m128 speed_4 = _mm_set1_ps(speed);
+    const __m128 zero_4 = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+        __m128 dx = _mm_sub_ps(target_x4, px);
+        __m128 dy = _mm_sub_ps(target_y4, py);
+        __m128 dz = _mm_sub_ps(target_z4, pz);
+        __m128 distance_2 = _mm_add_ps(_mm_mul_ps(dx, dx),
+            _mm_add_ps(_mm_mul_ps(dy, dy), _mm_mul_ps(dz, dz)));
 
-void Light::moveToward(float time, glm::vec3 pos, glm::vec3 toward, float speed) {
-	this->position = Entity::moveToward(time, pos, toward, speed);
-}
+        __m128 moving = _mm_and_ps(_mm_cmple_ps(distance_2, radius_4), _mm_cmpgt_ps(distance_2, zero_4));
+        __m128 step = _mm_and_ps(moving, _mm_div_ps(speed_4, _mm_sqrt_ps(distance_2)));
 
-// Get a light's position.
-glm::vec3 Light::getPosition() { return this->position; }
+        _mm_storeu_ps(x + i, _mm_add_ps(px, _mm_mul_ps(dx, step)));
+        _mm_storeu_ps(y + i, _mm_add_ps(py, _mm_mul_ps(dy, step)));
+        _mm_storeu_ps(z + i, _mm_add_ps(pz, _mm_mul_ps(dz, step)));
+    }
+#endif
 
-// Render a simple model to give a hint as what the light is.
-void Light::render(unsigned int shader, glm::vec3 offset,
-    glm::mat4 model_matrix, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]) {
-    // If it is a point light, draw a sphere.
-    if (this->type == LIGHT_OMNI) {
-        RawModelFactory::renderModel(RAW_MODEL_SPHERE, material,
-            this->position + offset, this->size, model_matrix, glm::mat4(),
-            shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
-    } // If it is a spotlight, draw a cone.
-    else {
-        RawModelFactory::renderModel(RAW_MODEL_CONE, material,
-            this->position + offset, this->size, model_matrix, glm::mat4(),
-            shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
+    for (; i < count; i++) {
+        float dx = target.x - x[i], dy = target.y - y[i], dz = target.z - z[i];
+        float distance_2 = dx * dx + dy * dy + dz * dz;
+        if (distance_2 > radius_2 || distance_2 <= 0) continue;
+
+        float step = speed / sqrtf(distance_2);
+        x[i] += dx * step;
+        y[i] += dy * step;
+        z[i] += dz * step;
     }
 }
 
 // Assign variables, initialize the simple random number generator from C++.
 LightSystem::LightSystem(unsigned int type, Camera* camera)
-: Entity(glm::vec3(0, 0, 0), camera->forward, camera->right, camera->up) {
+: Entity(glm::vec3(0, 0, 0), camera->forward, camera->right, camera->up),
+  light_grid(LIGHT_GRID_CELL_SIZE) {
     this->type = type;
     this->setRelativePosition(camera->position + glm::vec3(0,5.0f,0));
     this->light_count = 0;
+    this->light_limit = LIGHT_SHADER_MAXIMUM_COUNT;
     this->fog = true;
 	this->canMove = true;
 
@@ -62,7 +96,11 @@ LightSystem::LightSystem(unsigned int type, Camera* camera)
 }
 
 // Deconstructor.
-LightSystem::~LightSystem() {}
+LightSystem::~LightSystem() {
+    for (int i = 0; i < this->light_count; i++) {
+        delete this->light_materials[i];
+    }
+}
 
 // Adds a new light to the system.
 void LightSystem::addLight(glm::vec3 cameraPosition) {
@@ -90,14 +128,16 @@ void LightSystem::addLight(glm::vec3 cameraPosition) {
         RawModelMaterial* material = new RawModelMaterial(LIGHT_SHININESS,
             color * 1.2f, color, color, color * 1.4f);
 
-        Light* new_light = new Light(this->type, position, material, size);
-
         // Assign the light variables, for later use.
-        this->lights[this->light_count] = new_light;
-        this->light_colors[this->light_count] = color;
-        this->light_sizes[this->light_count] = size;
-        this->light_inner_angles[this->light_count] = glm::cos(inner_angle);
-        this->light_outer_angles[this->light_count] = glm::cos(outer_angle);
+        this->light_x.push_back(position.x);
+        this->light_y.push_back(position.y);
+        this->light_z.push_back(position.z);
+        this->light_colors.push_back(color);
+        this->light_sizes.push_back(size);
+        this->light_inner_angles.push_back(glm::cos(inner_angle));
+        this->light_outer_angles.push_back(glm::cos(outer_angle));
+        this->light_materials.push_back(material);
+        this->light_grid.insert(this->light_count, position);
 
         this->light_count++;
     }
@@ -107,67 +147,182 @@ void LightSystem::addLight(glm::vec3 cameraPosition) {
 void LightSystem::switchType() {
     if (this->type == LIGHT_OMNI) this->type = LIGHT_SPOT;
     else this->type = LIGHT_OMNI;
-
-    for (int i = 0; i < this->light_count; i++) {
-        this->lights[i]->setType(type);
-    }
 }
 
+void LightSystem::setSeed(unsigned int seed) { srand(seed); }
+
 void LightSystem::switchCanMove() {
 	this->canMove = !this->canMove;
 	printf("canMove: " + this->canMove);
 }
 
+// Limit the number of active lights.
+void LightSystem::setLightLimit(int limit) {
+    this->light_limit = glm::clamp(limit, 0, LIGHT_SHADER_MAXIMUM_COUNT);
+}
+int LightSystem::getLightLimit() { return this->light_limit; }
+
 // Update the system's relative position.
 void LightSystem::setRelativePosition(glm::vec3 position) {
     this->relative_position = position;
 }
 
 
-void LightSystem::move(float time, glm::vec3 camPos, float speed) {
+void LightSystem::move(float /*time*/, glm::vec3 camPos, float speed) {
+	CpuProfileZone zone("light movement");
+
 	if (this->canMove) {
 		//glm::vec3 movement = Entity::move(time, glm::vec2(0, 0)); // Move the light system on the intended path. The system is actually rendered based on the relative position.
 		glm::vec3 offset = glm::vec3(0, -400.0f, -300.0f);
 	
-		// Move all the lights when not close to player
-		for (int i = 0; i < this->light_count; i++) {
-			if (glm::distance(camPos + offset, this->lights[i]->getPosition()) <= 1500.0f) {
-				this->lights[i]->moveToward(time, this->lights[i]->getPosition(), camPos + offset, speed);
-			}
-			//this->lights[i]->move(movement);
+		// Move the lights close enough to the player, the grid finds them
+		// without looking at the others
+		glm::vec3 target = camPos + offset;
+		glm::vec3 reach = glm::vec3(LIGHT_MOVE_RADIUS);
+		this->light_nearby.clear();
+		this->light_grid.query(target - reach, target + reach, this->light_nearby);
+
+		int count = (int)this->light_nearby.size();
+		if (count == 0) return;
+		this->moving_x.resize(count);
+		this->moving_y.resize(count);
+		this->moving_z.resize(count);
+		for (int i = 0; i < count; i++) {
+			int light = this->light_nearby[i];
+			this->moving_x[i] = this->light_x[light];
+			this->moving_y[i] = this->light_y[light];
+			this->moving_z[i] = this->light_z[light];
+		}
+
+		moveLightsToward(&this->moving_x[0], &this->moving_y[0], &this->moving_z[0],
+			count, target, LIGHT_MOVE_RADIUS, speed);
+
+		for (int i = 0; i < count; i++) {
+			int light = this->light_nearby[i];
+			this->light_x[light] = this->moving_x[i];
+			this->light_y[light] = this->moving_y[i];
+			this->light_z[light] = this->moving_z[i];
+			this->light_grid.update(light, glm::vec3(this->moving_x[i], this->moving_y[i], this->moving_z[i]));
 		}
 	}
 }
 
+// Find lights through the grid, then keep the ones really inside.
+void LightSystem::queryRadius(glm::vec3 center, float radius, std::vector<int>& result) {
+    glm::vec3 local = center - this->relative_position;
+    size_t first = result.size();
+
+    this->light_grid.query(local - glm::vec3(radius), local + glm::vec3(radius), result);
+    size_t kept = first;
+    for (size_t i = first; i < result.size(); i++) {
+        int light = result[i];
+        float dx = this->light_x[light] - local.x, dy = this->light_y[light] - local.y, dz = this->light_z[light] - local.z;
+        if (dx * dx + dy * dy + dz * dz <= radius * radius) result[kept++] = light;
+    }
+    result.resize(kept);
+}
+
+void LightSystem::queryBox(glm::vec3 minimum, glm::vec3 maximum, std::vector<int>& result) {
+    glm::vec3 low = minimum - this->relative_position, high = maximum - this->relative_position;
+    size_t first = result.size();
+
+    this->light_grid.query(low, high, result);
+    size_t kept = first;
+    for (size_t i = first; i < result.size(); i++) {
+        int light = result[i];
+        if (this->light_x[light] < low.x || this->light_x[light] > high.x) continue;
+        if (this->light_y[light] < low.y || this->light_y[light] > high.y) continue;
+        if (this->light_z[light] < low.z || this->light_z[light] > high.z) continue;
+        result[kept++] = light;
+    }
+    result.resize(kept);
+}
+
+// Keep the lights nearest to the viewer, in light order so the choice is stable.
+// The radius grows until it holds the light limit or every light. The lights
+// inside a sphere are nearer than any outside it, so the nearest ones are
+// always found.
+void LightSystem::selectLights(glm::vec3 position) {
+    CpuProfileZone zone("light selection");
+    glm::vec3 local = position - this->relative_position;
+
+    float radius = LIGHT_SELECT_RADIUS;
+    this->light_nearby.clear();
+    this->queryRadius(position, radius, this->light_nearby);
+    while ((int)this->light_nearby.size() < this->light_limit &&
+        this->light_nearby.size() < this->light_x.size()) {
+        radius *= 2.0f;
+        this->light_nearby.clear();
+        this->queryRadius(position, radius, this->light_nearby);
+    }
+
+    this->light_active.clear();
+    if ((int)this->light_nearby.size() <= this->light_limit) {
+        this->light_active = this->light_nearby;
+    }
+    else {
+        this->light_distances.clear();
+        for (size_t i = 0; i < this->light_nearby.size(); i++) {
+            int light = this->light_nearby[i];
+            float dx = this->light_x[light] - local.x, dy = this->light_y[light] - local.y, dz = this->light_z[light] - local.z;
+            this->light_distances.push_back(std::make_pair(dx * dx + dy * dy + dz * dz, light));
+        }
+        std::nth_element(this->light_distances.begin(), this->light_distances.begin() + this->light_limit,
+            this->light_distances.end());
+        for (int i = 0; i < this->light_limit; i++) {
+            this->light_active.push_back(this->light_distances[i].second);
+        }
+    }
+    std::sort(this->light_active.begin(), this->light_active.end());
+}
+
 // Switch the fog on and off.
 void LightSystem::switchFog() { this->fog = !this->fog; }
 
-// Render the light system.
-void LightSystem::render(unsigned int shader, glm::mat4 model_matrix, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]) {
-    glm::vec3 offset = this->relative_position;
+unsigned int LightSystem::getType() { return this->type; }
 
-    // Turn the fog on or off and send fog variables.
-    glUniform1i(glGetUniformLocation(shader, "fog_switch"), this->fog);
-	glUniform1i(glGetUniformLocation(shader, "light_type"), this->type);
-    
+// Send light sources information to the shader. Every program variant that is
+// lit by the system needs it.
+void LightSystem::uploadLights(unsigned int shader) {
+    int active_count = glm::min((int)this->light_active.size(), this->light_limit);
 
-    // Render all the individual light models.
-    for (int i = 0; i < this->light_count; i++) {
-        this->lights[i]->render(shader, offset, model_matrix, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
-        this->light_positions[i] = offset + this->lights[i]->getPosition();
+    for (int i = 0; i < active_count; i++) {
+        int light = this->light_active[i];
+        this->light_positions[i] = this->relative_position +
+            glm::vec3(this->light_x[light], this->light_y[light], this->light_z[light]);
+        this->active_colors[i] = this->light_colors[light];
+        this->active_sizes[i] = this->light_sizes[light];
+        this->active_inner_angles[i] = this->light_inner_angles[light];
+        this->active_outer_angles[i] = this->light_outer_angles[light];
     }
 
-    // Send light sources information to the shader.
-    glUniform1i(glGetUniformLocation(shader, "light_count"), this->light_count);
-    //glUniform1i(glGetUniformLocation(shader, "light_type"), this->type);
+    glUniform1i(glGetUniformLocation(shader, "light_count"), active_count);
     glUniform3fv(glGetUniformLocation(shader, "light_positions"),
-        this->light_count, (GLfloat*)this->light_positions);
+        active_count, (GLfloat*)this->light_positions);
     glUniform4fv(glGetUniformLocation(shader, "light_colors"),
-        this->light_count, (GLfloat*)this->light_colors);
+        active_count, (GLfloat*)this->active_colors);
     glUniform1fv(glGetUniformLocation(shader, "light_inner_angles"),
-        this->light_count, (GLfloat*)this->light_inner_angles);
+        active_count, (GLfloat*)this->active_inner_angles);
     glUniform1fv(glGetUniformLocation(shader, "light_outer_angles"),
-        this->light_count, (GLfloat*)this->light_outer_angles);
+        active_count, (GLfloat*)this->active_outer_angles);
     glUniform1fv(glGetUniformLocation(shader, "light_sizes"),
-        this->light_count, (GLfloat*)this->light_sizes);
+        active_count, (GLfloat*)this->active_sizes);
+}
+
+// Render the individual light models. The light type is not a uniform, it
+// selects the shader variant (see getType).
+void LightSystem::render(unsigned int shader, glm::mat4 model_matrix, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]) {
+    glm::vec3 offset = this->relative_position;
+    int active_count = glm::min((int)this->light_active.size(), this->light_limit);
+
+    // Point lights are drawn as spheres, spotlights as cones.
+    unsigned int model = (this->type == LIGHT_OMNI) ? RAW_MODEL_SPHERE : RAW_MODEL_CONE;
+
+    for (int i = 0; i < active_count; i++) {
+        int light = this->light_active[i];
+        glm::vec3 position = glm::vec3(this->light_x[light], this->light_y[light], this->light_z[light]);
+        RawModelFactory::renderModel(model, this->light_materials[light],
+            position + offset, glm::vec3(this->light_sizes[light]), model_matrix, glm::mat4(),
+            shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
+    }
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 * Description: Light ensemble system, controlling all light sources
 */
 
+#pragma once
+
 #include <stdlib.h>
 #include <time.h>
 #include "glm\glm.hpp"
@@ -12,6 +14,8 @@
 #include "entity.h"
 #include "camera.h"
 #include "texture_loader.h"
+#include "light_grid.h"
+#include <vector>
 
 // Fog constants
 #define FOG_START_RADIUS 1200.0f
@@ -60,33 +64,19 @@ static const float LIGHT_RANGE_SIZE = LIGHT_MAXIMUM_SIZE - LIGHT_MINIMUM_SIZE;
 static const glm::vec4 LIGHT_AMBIENTAL = glm::vec4(0, 0, 0, 1);
 
 // Maximum number of lights
-#define LIGHT_MAXIMUM_COUNT 100
-
-class Light : public Entity {
-public:
-	//of type at position with material for light calculations and a size
-    Light(unsigned int type, glm::vec3 position, RawModelMaterial* material,
-        float size);
-    ~Light();
-
-	//omni vs spotlight
-    void setType(unsigned int type);
+#define LIGHT_MAXIMUM_COUNT 131072
 
-	//directional and dependant move functions
-    void move(glm::vec3 movement);
-	void moveToward(float time, glm::vec3 pos, glm::vec3 toward, float speed);
+// Size of the light arrays in min.frag (max_lights), lights past it are not
+// drawn or sent to the shader.
+#define LIGHT_SHADER_MAXIMUM_COUNT 50
 
-	//hands off matrices and other required values to renderer
-    void render(unsigned int shader, glm::vec3 offset, glm::mat4 model_matrix, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]);
-
-    glm::vec3 getPosition();
+// Lights further than this from the point they move toward stay in place
+#define LIGHT_MOVE_RADIUS 1500.0f
 
-private:
-    glm::vec3 position;
-    glm::vec3 size;
-    unsigned int type;
-    RawModelMaterial* material;
-};
+// First radius searched for the active lights around the camera. It doubles
+// until it holds the light limit, so no light is dropped for its distance
+// alone.
+#define LIGHT_SELECT_RADIUS 3000.0f
 
 class LightSystem : public Entity {
 public:
@@ -99,25 +89,66 @@ public:
 
 	void switchCanMove();
 
+	// Replace the time based seed of the light colors, sizes and angles
+	void setSeed(unsigned int seed);
+
+	// Number of lights drawn and shaded, the rest only move
+	void setLightLimit(int limit);
+	int getLightLimit();
+
 	//can be set relative to the player or another object
     void setRelativePosition(glm::vec3 position);
     void switchFog();
 
+	// State selecting the shader variant
+	unsigned int getType();
+
 	//directional move function
     void move(float time, glm::vec3 camPos, float speed);
 
+	// Append the lights within radius of center, or inside the box, in world
+	// coordinates
+	void queryRadius(glm::vec3 center, float radius, std::vector<int>& result);
+	void queryBox(glm::vec3 minimum, glm::vec3 maximum, std::vector<int>& result);
+
+	// Pick the active lights, drawn and sent to shaders: the ones nearest to
+	// position, up to the light limit, however far they are. Call once per
+	// view.
+	void selectLights(glm::vec3 position);
+
+	//sends the active light sources to a shader lit by them
+	void uploadLights(unsigned int shader);
+
 	//hands off matrices and other required values to renderer
     void render(unsigned int shader, glm::mat4 model_matrix, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]);
 
 private:
     glm::vec3 relative_position;
-    Light* lights[LIGHT_MAXIMUM_COUNT];
-    glm::vec3 light_positions[LIGHT_MAXIMUM_COUNT];
-    glm::vec4 light_colors[LIGHT_MAXIMUM_COUNT];
-    float light_sizes[LIGHT_MAXIMUM_COUNT];
-    float light_inner_angles[LIGHT_MAXIMUM_COUNT];
-    float light_outer_angles[LIGHT_MAXIMUM_COUNT];
+
+    // One array per light attribute, indexed by light, so movement streams
+    // through the positions alone.
+    std::vector<float> light_x, light_y, light_z;
+    std::vector<glm::vec4> light_colors;
+    std::vector<float> light_sizes;
+    std::vector<float> light_inner_angles;
+    std::vector<float> light_outer_angles;
+    std::vector<RawModelMaterial*> light_materials;
     int light_count;
+
+    // Light positions, as set by addLight and move
+    LightGrid light_grid;
+    std::vector<int> light_nearby;
+    std::vector<float> moving_x, moving_y, moving_z;
+    std::vector<std::pair<float, int> > light_distances;
+
+    // Chosen by selectLights, and their values as sent to the shader
+    std::vector<int> light_active;
+    glm::vec3 light_positions[LIGHT_SHADER_MAXIMUM_COUNT];
+    glm::vec4 active_colors[LIGHT_SHADER_MAXIMUM_COUNT];
+    float active_sizes[LIGHT_SHADER_MAXIMUM_COUNT];
+    float active_inner_angles[LIGHT_SHADER_MAXIMUM_COUNT];
+    float active_outer_angles[LIGHT_SHADER_MAXIMUM_COUNT];
+    int light_limit;
     unsigned int type;
     bool fog;
 	bool canMove;
@@ -25,9 +25,18 @@
 #include "minimalOpenGL.h"
 #include "mesh_loader.h"
 #include "raw_model.h"
+#include "asset_manager.h"
 #include "light_system.h"
 #include "entity.h"
 #include "world.h"
+#include "resolution_scaler.h"
+#include "quality_governor.h"
+#include "shader_cache.h"
+#include "shader_permutations.h"
+#include "gl_state.h"
+#include "gpu_profiler.h"
+#include "cpu_profiler.h"
+#include "benchmark.h"
 
 #ifdef _VR
 #   include "minimalOpenVR.h"
@@ -47,13 +56,21 @@ int keys[1024] = { 0 }; //0 = init, 1 = pressed, 2 = released
 // PROTOTYPES
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void getTime(float *previous_time, float *deltaTime, float *time);
-void reloadShader(GLuint *shader);
+void setupShader(GLuint shader, GLuint uniformBindingPoint);
+void reloadShader(ShaderCache* shaders, int id, const char* vertexFile, const char* pixelFile, GLuint *shader, GLuint uniformBindingPoint);
+void reloadShader(ShaderPermutations* shader, const char* vertexFile, const char* pixelFile, GLuint uniformBindingPoint);
 
 int main(const int argc, const char* argv[]) {
 
-    std::cout << "Spectral Slack\n\nW, A, S, D, Space, and C keys to translate\nMouse click and drag to rotate\nESC to quit\n\n";
+    std::cout << "Spectral Slack\n\nW, A, S, D, Space, and C keys to translate\nMouse click and drag to rotate\nP to toggle the depth pre-pass\nB to toggle baked terrain colors\nR to toggle dynamic resolution\nO to toggle the quality governor\nJ to export a Chrome trace of the last frames\nESC to quit\n\n";
     std::cout << std::fixed;
 
+	// --benchmark [frames] renders a scripted flight offscreen and writes the timings to JSON
+	Benchmark* benchmark = nullptr;
+	if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+		benchmark = new Benchmark(argc > 2 ? atoi(argv[2]) : BENCHMARK_FRAMES);
+	}
+
 	//////////////////////////////////////////////////////////////////////
 	// Instantiate values
 
@@ -69,25 +86,36 @@ int main(const int argc, const char* argv[]) {
     const int windowHeight = 720;
     const int windowWidth = (framebufferWidth * windowHeight) / framebufferHeight;
 
-    window = initOpenGL(windowWidth, windowHeight, "minimalOpenGL");
+    window = initOpenGL(windowWidth, windowHeight, "minimalOpenGL", benchmark != nullptr);
 	glfwSetKeyCallback(window, key_callback);
         
     glm::vec3 bodyTranslation = glm::vec3();
     glm::vec3 bodyRotation;
 
+	// Models and textures load on worker threads from here on
+	AssetManager::initialize();
 	RawModelFactory::instantiateModelFactory();
 	
 	bool wireframe = false;
-	glPolygonMode(GL_FRONT_AND_BACK, (wireframe ? GL_LINE : GL_FILL));
+	GLState::polygonMode(wireframe ? GL_LINE : GL_FILL);
 
 	bool lights_on = true;
 
+	// Lay down terrain and light proxy depth first, so the expensive shading
+	// in min.frag runs once per pixel (GL_EQUAL) instead of once per fragment.
+	bool depth_prepass = true;
+
 	Camera* camera = new Camera();
 
+	if (benchmark) { World::setSeed(BENCHMARK_SEED); }
 	World* world = new World(glm::vec3(), MOUNTAIN_JAG, WORLD_MODE_FRACTAL);
 	//world->setMode();
 
 	LightSystem* light_system = new LightSystem(LIGHT_OMNI, camera);
+	if (benchmark) {
+		light_system->setSeed(BENCHMARK_SEED);
+		benchmark->getCameraPose(&bodyTranslation, &bodyRotation);
+	}
 	//light_system->switchFog();
 
 	float time;
@@ -98,6 +126,8 @@ int main(const int argc, const char* argv[]) {
 	// Allocate the frame buffer. This code allocates one framebuffer per eye.
 	// That requires more GPU memory, but is useful when performing temporal 
 	// filtering or making render calls that can target both simultaneously.
+	// Targets are allocated at the maximum size, dynamic resolution renders
+	// into a scaled viewport at their origin.
 
 	GLuint framebuffer[numEyes];
 	glGenFramebuffers(numEyes, framebuffer);
@@ -106,7 +136,7 @@ int main(const int argc, const char* argv[]) {
 	glGenTextures(numEyes, colorRenderTarget);
 	glGenTextures(numEyes, depthRenderTarget);
 	for (int eye = 0; eye < numEyes; ++eye) {
-		glBindTexture(GL_TEXTURE_2D, colorRenderTarget[eye]);
+		GLState::bindTexture(0, GL_TEXTURE_2D, colorRenderTarget[eye]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -114,7 +144,7 @@ int main(const int argc, const char* argv[]) {
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, framebufferWidth, framebufferHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 		assert(glGetError() == GL_NONE);
 
-		glBindTexture(GL_TEXTURE_2D, depthRenderTarget[eye]);
+		GLState::bindTexture(0, GL_TEXTURE_2D, depthRenderTarget[eye]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -122,26 +152,41 @@ int main(const int argc, const char* argv[]) {
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, framebufferWidth, framebufferHeight, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
 		assert(glGetError() == GL_NONE);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer[eye]);
+		GLState::bindFramebuffer(GL_FRAMEBUFFER, framebuffer[eye]);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorRenderTarget[eye], 0);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthRenderTarget[eye], 0);
 		assert(glGetError() == GL_NONE);
 	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState::bindFramebuffer(GL_FRAMEBUFFER, 0);
 
     //////////////////////////////////////////////////////////////////////
-    // Create the main shader
-    GLuint shader = createShaderProgram(loadTextFile("min.vert"), loadTextFile("min.frag"));
+    // Register every program, then build them together: binaries cached by a
+    // previous launch are reused and the rest compile in parallel
+    ShaderCache* shaders = new ShaderCache(SHADER_CACHE_DIRECTORY);
+    // The main shader is specialized on mountain colors, light type and lights
+    // on/off (see the top of min.frag), one variant per combination
+    ShaderPermutations* mainShaders = new ShaderPermutations(shaders, "min", loadTextFile("min.vert"), loadTextFile("min.frag"),
+        { "MOUNTAIN_COLORS", "LIGHT_TYPE", "LIGHTS_ON" }, { WORLD_COLORS_COUNT, 2, 2 });
+    // Depth-only shader for the pre-pass, sharing the main uniform block
+    const int depthShaderId = shaders->add("depth", loadTextFile("depth.vert"), loadTextFile("depth.frag"));
+    const int skyBakeShaderId = shaders->add("sky_bake", skyVertexSource(), skyBakeSource());
+    const int skyShaderId = shaders->add("sky", skyVertexSource(), skySource());
+    shaders->build();
+
+    GLuint depthShader = shaders->getProgram(depthShaderId);
+
+    // Sky shaders and the cubemap caching the procedural sky
+    initSky(shaders->getProgram(skyBakeShaderId), shaders->getProgram(skyShaderId));
 
     // Binding points for attributes and uniforms discovered from the shader
-    const GLint positionAttribute   = glGetAttribLocation(shader,  "position");
-    const GLint normalAttribute     = glGetAttribLocation(shader,  "normal");
-    const GLint texCoordAttribute   = glGetAttribLocation(shader,  "texCoord"); 
-    const GLint colorTextureUniform = glGetUniformLocation(shader, "colorTexture");
-
+    // All variants declare the same shared uniform block, any of them can be queried
+    const GLuint shader = mainShaders->getProgram(0);
     const GLuint uniformBlockIndex = glGetUniformBlockIndex(shader, "Uniform");
     const GLuint uniformBindingPoint = 6;
-    glUniformBlockBinding(shader, uniformBlockIndex, uniformBindingPoint);
+    for (int i = 0; i < mainShaders->getCount(); ++i) {
+        setupShader(mainShaders->getProgram(i), uniformBindingPoint);
+    }
+    setupShader(depthShader, uniformBindingPoint);
 
     GLuint uniformBlock;
     glGenBuffers(1, &uniformBlock);
@@ -190,19 +235,8 @@ int main(const int argc, const char* argv[]) {
     assert(uniformOffset[0] >= 0);
 	assert(glGetError() == GL_NONE);
 
-    // Load a texture map
-    GLuint colorTexture = GL_NONE;
-    {
-        int textureWidth, textureHeight, channels;
-        std::vector<std::uint8_t> data;
-        loadBMP("color.bmp", textureWidth, textureHeight, channels, data);
-
-        glGenTextures(1, &colorTexture);
-        glBindTexture(GL_TEXTURE_2D, colorTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, textureWidth, textureHeight, 0, (channels == 3) ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, &data[0]);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-	assert(glGetError() == GL_NONE);
+    // Load a texture map, a placeholder is bound until it is uploaded
+    AssetHandle colorTexture = AssetManager::loadTexture("color.bmp");
 
     GLuint trilinearSampler = GL_NONE;
     {
@@ -242,33 +276,6 @@ int main(const int argc, const char* argv[]) {
 	const float farPlaneZ = 15000.0f;
 	const float verticalFieldOfView = glm::radians(45.0f);
 
-	glUseProgram(shader);
-
-	glUniform4f(glGetUniformLocation(shader, "background_color"),
-		BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b,
-		BACKGROUND_COLOR.a);
-
-	//send top and bottom world color thresholds
-	glUniform4f(glGetUniformLocation(shader, "color_top"),
-		WORLD_TOP_COLOR.r, WORLD_TOP_COLOR.g, WORLD_TOP_COLOR.b, WORLD_TOP_COLOR.a);
-	glUniform4f(glGetUniformLocation(shader, "color_bottom"),
-		WORLD_BOTTOM_COLOR.r, WORLD_BOTTOM_COLOR.g, WORLD_BOTTOM_COLOR.b,
-		WORLD_BOTTOM_COLOR.a);
-
-	//send fog information
-	glUniform1f(glGetUniformLocation(shader, "fog_start"), FOG_START_RADIUS);
-	glUniform1f(glGetUniformLocation(shader, "fog_end"), FOG_END_RADIUS);
-	glUniform4f(glGetUniformLocation(shader, "fog_color"),
-		FOG_COLOR.x, FOG_COLOR.y, FOG_COLOR.z, FOG_COLOR.a);
-
-	glUniform4f(glGetUniformLocation(shader, "ambiental_light"),
-		LIGHT_AMBIENTAL.x, LIGHT_AMBIENTAL.y, LIGHT_AMBIENTAL.z,
-		LIGHT_AMBIENTAL.a);
-
-	glUniform3f(glGetUniformLocation(shader, "spotlight_direction"),
-		LIGHT_SPOT_DIRECTION.x, LIGHT_SPOT_DIRECTION.y,
-		LIGHT_SPOT_DIRECTION.z);
-	
 	/////////////////////////////////////////////////////////////////////
     // Main loop
     int timer = 0;
@@ -276,17 +283,47 @@ int main(const int argc, const char* argv[]) {
 	int totalFrames = 0;
 	float averageFrame;
 
+	ResolutionScaler* resolution = new ResolutionScaler(RESOLUTION_TARGET_FRAME_TIME);
+	uint32_t renderWidth = framebufferWidth, renderHeight = framebufferHeight;
+
+	// GPU time per render pass, read back a few frames late
+	GpuProfiler* gpu = new GpuProfiler();
+
+	// Terrain detail, light count and noise octaves follow the frame budget
+	QualityGovernor* quality = new QualityGovernor(QUALITY_FRAME_BUDGET);
+	world->setTerrainLevel(quality->getQuality().terrain_level);
+	light_system->setLightLimit(quality->getQuality().light_limit);
+
+	// The benchmark measures a fixed workload, with everything loaded
+	if (benchmark) {
+		resolution->switchEnabled();
+		quality->switchEnabled();
+		AssetManager::finish();
+	}
+
     while (! glfwWindowShouldClose(window)) {
+        CpuProfileZone frameZone("frame");
         assert(glGetError() == GL_NONE);
 		
 		getTime(&previous_time, &deltaTime, &time); //WHAT YEAR IS IT
+		if (benchmark) { deltaTime = BENCHMARK_TIME_STEP; }
 		frameTimes[totalFrames++%100] = time;
+
+		// Upload what the asset workers have decoded, within a frame budget
+		{
+			CpuProfileZone zone("asset uploads");
+			AssetManager::update(ASSET_UPLOAD_BUDGET);
+		}
+
 		if (totalFrames == 100) {
 			averageFrame = 0;
 			for (int i = 0; i < 100; i++) {
 				averageFrame += frameTimes[i];
 			}
-			printf("Avg time per frame: %f\n", averageFrame / 100);
+			printf("Avg time per frame: %.2f ms, resolution scale: %.2f\n", averageFrame / 100, resolution->getScale());
+			GLState::printStatistics(100);
+			gpu->printStatistics();
+			CpuProfiler::printStatistics();
 			totalFrames = 0;
 		}
 
@@ -298,6 +335,11 @@ int main(const int argc, const char* argv[]) {
 		projectionMatrix[0] = glm::perspective(verticalFieldOfView, float(framebufferWidth / framebufferHeight), nearPlaneZ, farPlaneZ);
 #       endif
 
+		// Measured from here, after the compositor wait, to the buffer swap
+		const double frameStart = glfwGetTime();
+		resolution->getViewport(framebufferWidth, framebufferHeight, &renderWidth, &renderHeight);
+		gpu->beginFrame();
+
 		
 		cameraPosition = glm::vec3(cameraToWorldMatrix[3]);
 		model_matrix = glm::mat4(1.0f);
@@ -312,42 +354,86 @@ int main(const int argc, const char* argv[]) {
 		headToWorldMatrix = bodyToWorldMatrix * headToBodyMatrix;
 
         for (int eye = 0; eye < numEyes; ++eye) {
-            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer[eye]);
-            glViewport(0, 0, framebufferWidth, framebufferHeight);
+			cameraToWorldMatrix = headToWorldMatrix * eyeToHead[eye];
+
+			// Refresh the cached sky once per frame, both eyes share it
+			if (eye == 0) {
+				CpuProfileZone zone("sky update");
+				gpu->begin(GPU_PASS_SKY);
+#       ifdef _VR
+				updateSky(glm::value_ptr(glm::inverse(cameraToWorldMatrix)));
+#		else
+				updateSky(glm::value_ptr(cameraToWorldMatrix));
+#		endif
+				gpu->end(GPU_PASS_SKY);
+			}
+
+            GLState::bindFramebuffer(GL_FRAMEBUFFER, framebuffer[eye]);
+            GLState::viewport(0, 0, renderWidth, renderHeight);
 
             //glClearColor(0.1f, 0.2f, 0.3f, 0.0f);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-			cameraToWorldMatrix = headToWorldMatrix * eyeToHead[eye];
-
 			// Set drawing mode to fill, for other elements than the world
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+			GLState::polygonMode(GL_FILL);
 
 			//2nd shader sky drawer
+			{
+				CpuProfileZone zone("sky");
+				gpu->begin(GPU_PASS_SKY);
 #       ifdef _VR
-			drawSky(framebufferWidth, framebufferHeight, glm::value_ptr(glm::inverse(cameraToWorldMatrix)), glm::value_ptr(projectionMatrix[eye]));
+				drawSky(renderWidth, renderHeight, glm::value_ptr(glm::inverse(cameraToWorldMatrix)), glm::value_ptr(projectionMatrix[eye]));
 #		else
-			drawSky(framebufferWidth, framebufferHeight, glm::value_ptr(cameraToWorldMatrix), glm::value_ptr(projectionMatrix[eye]));
+				drawSky(renderWidth, renderHeight, glm::value_ptr(cameraToWorldMatrix), glm::value_ptr(projectionMatrix[eye]));
 #		endif
+				gpu->end(GPU_PASS_SKY);
+			}
 			
-			glEnable(GL_DEPTH_TEST);
-			glDepthFunc(GL_LESS);
-			glEnable(GL_CULL_FACE);
-			glDepthMask(GL_TRUE);
+			GLState::enable(GL_DEPTH_TEST, true);
+			GLState::depthFunc(GL_LESS);
+			GLState::enable(GL_CULL_FACE, true);
+			GLState::depthMask(GL_TRUE);
 
-			glUseProgram(shader);
+			cameraPosition = glm::vec3(cameraToWorldMatrix[3]);
 
-			// uniform colorTexture - sampler binding
-			const GLint colorTextureUnit = 0;
-            glActiveTexture(GL_TEXTURE0 + colorTextureUnit);
-            glBindTexture(GL_TEXTURE_2D, colorTexture);
-            glBindSampler(colorTextureUnit, trilinearSampler);
-            glUniform1i(colorTextureUniform, colorTextureUnit);
+			// The lights near this eye are drawn and shade it, the far ones are skipped
+			light_system->selectLights(cameraPosition);
 
-			glUniform1i(glGetUniformLocation(shader, "lights_on"),
-				lights_on);
+			// Depth pre-pass: same draws as below with color writes off, then
+			// shade only the fragments that won the depth test.
+			if (depth_prepass) {
+				CpuProfileZone zone("depth prepass");
+				gpu->begin(GPU_PASS_DEPTH);
+				GLState::colorMask(GL_FALSE);
+				GLState::useProgram(depthShader);
 
-			cameraPosition = glm::vec3(cameraToWorldMatrix[3]);
+				model_matrix = glm::mat4(1.0f);
+				modelViewProjectionMatrix = glm::mat4(1.0f);
+				objectToWorldMatrix = glm::mat4(1.0f);
+
+				light_system->render(depthShader, model_matrix, &objectToWorldMatrix, &projectionMatrix[eye], &cameraToWorldMatrix, &modelViewProjectionMatrix, &objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
+
+				GLState::polygonMode(wireframe ? GL_LINE : GL_FILL);
+				world->render(depthShader, model_matrix, cameraPosition, &objectToWorldMatrix, &projectionMatrix[eye], &cameraToWorldMatrix, &modelViewProjectionMatrix, &objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
+				GLState::polygonMode(GL_FILL);
+
+				GLState::colorMask(GL_TRUE);
+				GLState::depthFunc(GL_EQUAL);
+				GLState::depthMask(GL_FALSE);
+				gpu->end(GPU_PASS_DEPTH);
+			}
+
+			// Pick the shader variants matching the current state, so no
+			// fragment has to branch on it
+			int proxyOptions[] = { WORLD_COLORS_NONE, int(light_system->getType()), lights_on };
+			int terrainOptions[] = { int(world->getColorMode()), int(light_system->getType()), lights_on };
+			const GLuint proxyShader = mainShaders->getProgram(proxyOptions);
+			const GLuint terrainShader = mainShaders->getProgram(terrainOptions);
+
+			// uniform colorTexture - sampler binding, set up in setupShader
+			const GLint colorTextureUnit = 0;
+            GLState::bindTexture(colorTextureUnit, GL_TEXTURE_2D, AssetManager::getTexture(colorTexture));
+            GLState::bindSampler(colorTextureUnit, trilinearSampler);
 
 			//reset some matrices to prevent recursive transformations
 			model_matrix = glm::mat4(1.0f);
@@ -355,16 +441,44 @@ int main(const int argc, const char* argv[]) {
 			bodyToWorldMatrix = glm::mat4(1.0f);
 			objectToWorldMatrix = glm::mat4(1.0f);
 
-			light_system->render(shader, model_matrix, &objectToWorldMatrix, &projectionMatrix[eye], &cameraToWorldMatrix, &modelViewProjectionMatrix, &objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
+			{
+				CpuProfileZone zone("lights");
+				gpu->begin(GPU_PASS_LIGHTS);
+				GLState::useProgram(proxyShader);
+				light_system->uploadLights(proxyShader);
+				light_system->render(proxyShader, model_matrix, &objectToWorldMatrix, &projectionMatrix[eye], &cameraToWorldMatrix, &modelViewProjectionMatrix, &objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
+				gpu->end(GPU_PASS_LIGHTS);
+			}
 
 			// Draw the world
-			glPolygonMode(GL_FRONT_AND_BACK, (wireframe ? GL_LINE : GL_FILL));
-			world->render(shader, model_matrix, cameraPosition, &objectToWorldMatrix, &projectionMatrix[eye], &cameraToWorldMatrix, &modelViewProjectionMatrix, &objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
+			{
+				CpuProfileZone zone("terrain");
+				gpu->begin(GPU_PASS_TERRAIN);
+				GLState::useProgram(terrainShader);
+				light_system->uploadLights(terrainShader);
+				glUniform1i(glGetUniformLocation(terrainShader, "noise_octaves"),
+					quality->getQuality().noise_octaves);
+
+				GLState::polygonMode(wireframe ? GL_LINE : GL_FILL);
+				world->render(terrainShader, model_matrix, cameraPosition, &objectToWorldMatrix, &projectionMatrix[eye], &cameraToWorldMatrix, &modelViewProjectionMatrix, &objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
+				gpu->end(GPU_PASS_TERRAIN);
+			}
+
+			// Restore depth writes, otherwise the next clear leaves depth untouched
+			if (depth_prepass) {
+				GLState::depthFunc(GL_LESS);
+				GLState::depthMask(GL_TRUE);
+			}
 
 #           ifdef _VR
             {
+                // The compositor upscales the rendered region of the target
                 vr::Texture_t tex = { reinterpret_cast<void*>(intptr_t(colorRenderTarget[eye])), vr::TextureType_OpenGL, vr::ColorSpace_Gamma };
-                vr::VRCompositor()->Submit(vr::EVREye(eye), &tex);
+                vr::VRTextureBounds_t bounds = { 0.0f, 0.0f, float(renderWidth) / framebufferWidth, float(renderHeight) / framebufferHeight };
+                vr::VRCompositor()->Submit(vr::EVREye(eye), &tex, &bounds);
+
+                // The compositor may change GL state behind the tracker's back
+                GLState::invalidate();
             }
 #           endif
 			
@@ -377,14 +491,38 @@ int main(const int argc, const char* argv[]) {
 #       endif
 
         // Mirror to the window
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GL_NONE);
-        glViewport(0, 0, windowWidth, windowHeight);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glBlitFramebuffer(0, 0, framebufferWidth, framebufferHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, GL_NONE);
+        {
+            CpuProfileZone zone("blit");
+            gpu->begin(GPU_PASS_BLIT);
+            GLState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, GL_NONE);
+            GLState::viewport(0, 0, windowWidth, windowHeight);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            GLState::bindFramebuffer(GL_READ_FRAMEBUFFER, GL_NONE);
+            gpu->end(GPU_PASS_BLIT);
+        }
+        gpu->endFrame();
 
         // Display what has been drawn on the main window
-        glfwSwapBuffers(window);
+        const double cpuEnd = glfwGetTime();
+        {
+            CpuProfileZone zone("swap");
+            glfwSwapBuffers(window);
+        }
+
+        // Swap blocks while the GPU is behind, so this tracks GPU load too
+        const float frameTime = float(glfwGetTime() - frameStart);
+        resolution->update(frameTime);
+
+        // The GPU time lags a few frames, which the governor's hysteresis absorbs
+        if (quality->update(float(cpuEnd - frameStart), gpu->getFrameTime())) {
+            world->setTerrainLevel(quality->getQuality().terrain_level);
+            light_system->setLightLimit(quality->getQuality().light_limit);
+        }
+
+        if (benchmark && ! benchmark->recordFrame(float(cpuEnd - frameStart), frameTime)) {
+            glfwSetWindowShouldClose(window, 1);
+        }
 
         // Check for events
         glfwPollEvents();
@@ -419,8 +557,19 @@ int main(const int argc, const char* argv[]) {
 		if (keys[GLFW_KEY_E] == 1) { light_system->switchType(); }
 		if (keys[GLFW_KEY_G] == 1) { wireframe = !wireframe; }
 		if (keys[GLFW_KEY_F] == 1) { light_system->switchFog(); }
-		if (keys[GLFW_KEY_X] == 1) { reloadShader(&shader); }
+		if (keys[GLFW_KEY_X] == 1) {
+			reloadShader(mainShaders, "min.vert", "min.frag", uniformBindingPoint);
+			reloadShader(shaders, depthShaderId, "depth.vert", "depth.frag", &depthShader, uniformBindingPoint);
+		}
 		if (keys[GLFW_KEY_T] == 1) { light_system->switchCanMove(); }
+		if (keys[GLFW_KEY_B] == 1) { world->switchColorBake(); }
+		if (keys[GLFW_KEY_R] == 1) { resolution->switchEnabled(); }
+		if (keys[GLFW_KEY_O] == 1) { quality->switchEnabled(); }
+		if (keys[GLFW_KEY_J] == 1) { CpuProfiler::exportChromeTrace(CPU_PROFILER_TRACE_FILE); }
+		if (keys[GLFW_KEY_P] == 1) {
+			depth_prepass = !depth_prepass;
+			std::cout << "Depth pre-pass: " << (depth_prepass ? "on" : "off") << "\n";
+		}
 
 		/*if (keys[GLFW_KEY_I] == 2) { light_system->setControl(ENTITY_CONTROL_FORWARD); }
 		else { light_system->unsetControl(ENTITY_CONTROL_FORWARD); }
@@ -454,6 +603,12 @@ int main(const int argc, const char* argv[]) {
             inDrag = false;
         }
 
+		// The scripted flight replaces any input
+		if (benchmark) {
+			benchmark->getCameraPose(&bodyTranslation, &bodyRotation);
+			benchmark->updateLights(light_system, bodyTranslation);
+		}
+
 		light_system->move(deltaTime, cameraPosition, cameraMoveSpeed / 2.0f);
 
 		//reset keys in use
@@ -463,6 +618,11 @@ int main(const int argc, const char* argv[]) {
 		keys[GLFW_KEY_F] = 0;
 		keys[GLFW_KEY_X] = 0;
 		keys[GLFW_KEY_T] = 0;
+		keys[GLFW_KEY_B] = 0;
+		keys[GLFW_KEY_R] = 0;
+		keys[GLFW_KEY_O] = 0;
+		keys[GLFW_KEY_P] = 0;
+		keys[GLFW_KEY_J] = 0;
     }
 	
 #   ifdef _VR
@@ -471,12 +631,25 @@ int main(const int argc, const char* argv[]) {
         }
 #   endif
 	
+	// Keep the end of the session for offline analysis
+	CpuProfiler::exportChromeTrace(CPU_PROFILER_TRACE_FILE);
+	if (benchmark) {
+		benchmark->writeResults(BENCHMARK_OUTPUT, gpu);
+		benchmark->~Benchmark();
+	}
+
 	// Destructors
-	glDeleteProgram(shader);
+	mainShaders->~ShaderPermutations();
+	shaders->~ShaderCache();
 	camera->~Camera();
 	light_system->~LightSystem();
 	world->~World();
+	resolution->~ResolutionScaler();
+	quality->~QualityGovernor();
+	gpu->~GpuProfiler();
 	RawModelFactory::destructModelFactory();
+	AssetManager::release(colorTexture);
+	AssetManager::shutdown();
 
     // Close the GL context and release all resources
     glfwTerminate();
@@ -491,23 +664,65 @@ void getTime(float *previous_time, float *deltaTime, float *time) {
 	current_time = glfwGetTime();
 	*deltaTime = current_time - *previous_time;
 	*previous_time = current_time;
-	*time = (float)(*deltaTime) / 1000.0f;
+	*time = (float)(*deltaTime) * 1000.0f; // milliseconds
 }
 
-// Currently broken shader reloader
-void reloadShader(GLuint *shader) {
-	GLsizei shaderCount = 0;
-	GLuint shaders[] = { 0 };
+// Bind the uniform block and send the uniforms that never change. Needed again
+// whenever a program is rebuilt, as a new program starts with default values.
+void setupShader(GLuint shader, GLuint uniformBindingPoint) {
+	glUniformBlockBinding(shader, glGetUniformBlockIndex(shader, "Uniform"), uniformBindingPoint);
+
+	GLState::useProgram(shader);
+
+	glUniform4f(glGetUniformLocation(shader, "background_color"),
+		BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b,
+		BACKGROUND_COLOR.a);
+
+	//send top and bottom world color thresholds
+	glUniform4f(glGetUniformLocation(shader, "color_top"),
+		WORLD_TOP_COLOR.r, WORLD_TOP_COLOR.g, WORLD_TOP_COLOR.b, WORLD_TOP_COLOR.a);
+	glUniform4f(glGetUniformLocation(shader, "color_bottom"),
+		WORLD_BOTTOM_COLOR.r, WORLD_BOTTOM_COLOR.g, WORLD_BOTTOM_COLOR.b,
+		WORLD_BOTTOM_COLOR.a);
+
+	//send fog information
+	glUniform1f(glGetUniformLocation(shader, "fog_start"), FOG_START_RADIUS);
+	glUniform1f(glGetUniformLocation(shader, "fog_end"), FOG_END_RADIUS);
+	glUniform4f(glGetUniformLocation(shader, "fog_color"),
+		FOG_COLOR.x, FOG_COLOR.y, FOG_COLOR.z, FOG_COLOR.a);
+
+	glUniform4f(glGetUniformLocation(shader, "ambiental_light"),
+		LIGHT_AMBIENTAL.x, LIGHT_AMBIENTAL.y, LIGHT_AMBIENTAL.z,
+		LIGHT_AMBIENTAL.a);
+
+	glUniform3f(glGetUniformLocation(shader, "spotlight_direction"),
+		LIGHT_SPOT_DIRECTION.x, LIGHT_SPOT_DIRECTION.y,
+		LIGHT_SPOT_DIRECTION.z);
+
+	glUniform1i(glGetUniformLocation(shader, "colorTexture"), 0);
+}
+
+// Rebuild a program from its files. On a compile error the old program is kept.
+void reloadShader(ShaderCache* shaders, int id, const char* vertexFile, const char* pixelFile, GLuint *shader, GLuint uniformBindingPoint) {
+	if (!shaders->reload(id, loadTextFile(vertexFile), loadTextFile(pixelFile))) return;
+
+	// The new program may have been given the name of the deleted one
+	GLState::invalidate();
+	*shader = shaders->getProgram(id);
+	setupShader(*shader, uniformBindingPoint);
+	std::cout << "Reloaded " << vertexFile << " and " << pixelFile << "\n";
+}
 
-	glGetAttachedShaders(*shader, 1, &shaderCount, shaders);
+// Rebuild every variant of a specialized program from its files.
+void reloadShader(ShaderPermutations* shader, const char* vertexFile, const char* pixelFile, GLuint uniformBindingPoint) {
+	if (!shader->reload(loadTextFile(vertexFile), loadTextFile(pixelFile))) return;
 
-	for (int i = 0; i < shaderCount; i++) {
-		glDetachShader(*shader, shaders[i]);
-		glDeleteShader(shaders[i]);
+	// New programs may have been given the names of deleted ones
+	GLState::invalidate();
+	for (int i = 0; i < shader->getCount(); ++i) {
+		setupShader(shader->getProgram(i), uniformBindingPoint);
 	}
-	glDeleteProgram(*shader);
-	*shader = createShaderProgram(loadTextFile("min.vert"), loadTextFile("min.frag"));
-	std::cout << "hello";
+	std::cout << "Reloaded " << vertexFile << " and " << pixelFile << "\n";
 }
 
 // Is called whenever a key is pressed/released via GLFW
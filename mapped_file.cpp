@@ -0,0 +1,102 @@
+/**
+* Description: Read-only memory mapped file. The whole file is visible as one
+* contiguous range of bytes, without being copied into the heap.
+*/
+
+#include "mapped_file.h"
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename) {
+    LARGE_INTEGER file_size;
+
+    this->data = NULL;
+    this->size = 0;
+    this->opened = false;
+    this->mapping = NULL;
+
+    this->file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (this->file == INVALID_HANDLE_VALUE) return;
+
+    if (!GetFileSizeEx(this->file, &file_size)) return;
+    this->size = (size_t)file_size.QuadPart;
+    this->opened = true;
+
+    // Empty files can't be mapped, but they open fine.
+    if (this->size == 0) return;
+
+    this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0,
+        NULL);
+    if (this->mapping) {
+        this->data = (const char*)MapViewOfFile(this->mapping, FILE_MAP_READ,
+            0, 0, 0);
+    }
+    if (!this->data) {
+        this->size = 0;
+        this->opened = false;
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (this->data) UnmapViewOfFile(this->data);
+    if (this->mapping) CloseHandle(this->mapping);
+    if (this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename) {
+    struct stat file_stat;
+    int file = open(filename.c_str(), O_RDONLY);
+
+    this->data = NULL;
+    this->size = 0;
+    this->opened = false;
+
+    if (file < 0) return;
+
+    if (fstat(file, &file_stat) == 0) {
+        this->size = (size_t)file_stat.st_size;
+        this->opened = true;
+
+        // Empty files can't be mapped, but they open fine.
+        if (this->size > 0) {
+            void* address = mmap(NULL, this->size, PROT_READ, MAP_PRIVATE,
+                file, 0);
+
+            if (address == MAP_FAILED) {
+                this->size = 0;
+                this->opened = false;
+            }
+            else {
+                this->data = (const char*)address;
+                // The file is read front to back, let the kernel read ahead.
+                madvise(address, this->size, MADV_SEQUENTIAL);
+            }
+        }
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    close(file);
+}
+
+MappedFile::~MappedFile() {
+    if (this->data) munmap((void*)this->data, this->size);
+}
+
+#endif
+
+bool MappedFile::isOpen() { return this->opened; }
+const char* MappedFile::getData() { return this->data; }
+size_t MappedFile::getSize() { return this->size; }
@@ -0,0 +1,33 @@
+/**
+* Description: Read-only memory mapped file. The whole file is visible as one
+* contiguous range of bytes, without being copied into the heap.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+class MappedFile {
+public:
+    MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    bool isOpen();
+
+    // The file contents, not null terminated. NULL for an empty file.
+    const char* getData();
+    size_t getSize();
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* data;
+    size_t size;
+    bool opened;
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#endif
+};
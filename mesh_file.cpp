@@ -0,0 +1,136 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Compiled mesh files. A header with the vertex layout, then the vertex and index data,
+// aligned and ready for glBufferData. The file is mapped and read straight from the mapping.
+// ------------------------------------------------ -------------------------------------------------
+
+#include "mesh_file.h"
+#include "mapped_file.h"
+#include "gl_state.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+namespace mesh{
+    static uint64_t _align(uint64_t offset){
+        return (offset + MESH_FILE_ALIGNMENT - 1) / MESH_FILE_ALIGNMENT * MESH_FILE_ALIGNMENT;
+    }
+
+    //sizes, ranges and version, checked before anything is read past the header
+    static bool _isValidHeader(const MeshFileHeader *header, uint64_t size){
+        if (header->magic != MESH_FILE_MAGIC || header->version != MESH_FILE_VERSION) return false;
+        if (header->attribute_count > MESH_FILE_MAX_ATTRIBUTES || header->index_type != GL_UNSIGNED_INT) return false;
+        if (header->vertex_size != (uint64_t)header->vertex_count * header->vertex_stride) return false;
+        if (header->index_size != (uint64_t)header->index_count * sizeof(unsigned int)) return false;
+        if (header->vertex_offset > size || header->vertex_size > size - header->vertex_offset) return false;
+        if (header->index_offset > size || header->index_size > size - header->index_offset) return false;
+        if (header->meshlet_offset > size || header->meshlet_count > (size - header->meshlet_offset) / sizeof(Meshlet)) return false;
+        if (header->lod_count < 1 || header->lod_count > MESH_LOD_COUNT) return false;
+        for (uint32_t i = 0; i < header->lod_count; i++){
+            if (header->lod_first_index[i] > header->index_count || header->lod_index_count[i] > header->index_count - header->lod_first_index[i]) return false;
+        }
+        return true;
+    }
+
+    static void _readLods(const MeshFileHeader *header, MeshLodChain &lods){
+        lods.count = header->lod_count;
+        for (uint32_t i = 0; i < header->lod_count; i++){
+            lods.first_index[i] = header->lod_first_index[i];
+            lods.index_count[i] = header->lod_index_count[i];
+        }
+    }
+
+    bool saveMeshFile(const std::string &filename, const MeshData &mesh){
+        static const char padding[MESH_FILE_ALIGNMENT] = { 0 };
+        const std::vector<PackedVertexFormat> &vertices = mesh.vertices;
+        const std::vector<unsigned int> &indices = mesh.indices;
+        MeshFileHeader header = {};
+
+        //the layout of PackedVertexFormat: position, normal, texcoords
+        header.magic = MESH_FILE_MAGIC;
+        header.version = MESH_FILE_VERSION;
+        header.vertex_stride = sizeof(PackedVertexFormat);
+        header.attribute_count = 3;
+        header.attributes[0] = { 6, 3, GL_UNSIGNED_SHORT, GL_TRUE, (uint32_t)offsetof(PackedVertexFormat, position) };
+        header.attributes[1] = { 7, 2, GL_SHORT, GL_TRUE, (uint32_t)offsetof(PackedVertexFormat, normal) };
+        header.attributes[2] = { 8, 2, GL_HALF_FLOAT, GL_FALSE, (uint32_t)offsetof(PackedVertexFormat, texcoord) };
+        for (int i = 0; i < 3; i++){
+            header.position_offset[i] = mesh.position_offset[i];
+            header.position_scale[i] = mesh.position_scale[i];
+        }
+        header.lod_count = mesh.lods.count;
+        for (unsigned int i = 0; i < mesh.lods.count; i++){
+            header.lod_first_index[i] = mesh.lods.first_index[i];
+            header.lod_index_count[i] = mesh.lods.index_count[i];
+        }
+
+        header.vertex_count = (uint32_t)vertices.size();
+        header.index_count = (uint32_t)indices.size();
+        header.index_type = GL_UNSIGNED_INT;
+        header.vertex_offset = _align(sizeof(MeshFileHeader));
+        header.vertex_size = vertices.size() * sizeof(PackedVertexFormat);
+        header.index_offset = _align(header.vertex_offset + header.vertex_size);
+        header.index_size = indices.size() * sizeof(unsigned int);
+        header.meshlet_offset = _align(header.index_offset + header.index_size);
+        header.meshlet_count = mesh.meshlets.size();
+
+        FILE *file = fopen(filename.c_str(), "wb");
+        if (!file) return false;
+
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+        written = written && fwrite(padding, 1, header.vertex_offset - sizeof(header), file) == header.vertex_offset - sizeof(header);
+        if (header.vertex_size) written = written && fwrite(&vertices[0], header.vertex_size, 1, file) == 1;
+        uint64_t gap = header.index_offset - header.vertex_offset - header.vertex_size;
+        written = written && fwrite(padding, 1, gap, file) == gap;
+        if (header.index_size) written = written && fwrite(&indices[0], header.index_size, 1, file) == 1;
+        gap = header.meshlet_offset - header.index_offset - header.index_size;
+        written = written && fwrite(padding, 1, gap, file) == gap;
+        if (header.meshlet_count) written = written && fwrite(&mesh.meshlets[0], sizeof(Meshlet), mesh.meshlets.size(), file) == mesh.meshlets.size();
+        written = (fclose(file) == 0) && written;
+
+        //don't leave a truncated file behind, it would look newer than the source
+        if (!written) remove(filename.c_str());
+        return written;
+    }
+
+    bool readMeshFile(const std::string &filename, MeshData &mesh){
+        MappedFile file(filename);
+        if (!file.isOpen() || file.getSize() < sizeof(MeshFileHeader)) return false;
+
+        const char *data = file.getData();
+        const MeshFileHeader *header = (const MeshFileHeader*)data;
+        if (!_isValidHeader(header, file.getSize())) return false;
+        //only the layout of PackedVertexFormat can go through uploadMesh
+        if (header->vertex_stride != sizeof(PackedVertexFormat)) return false;
+
+        const PackedVertexFormat *vertices = (const PackedVertexFormat*)(data + header->vertex_offset);
+        const unsigned int *indices = (const unsigned int*)(data + header->index_offset);
+        mesh.vertices.assign(vertices, vertices + header->vertex_count);
+        mesh.indices.assign(indices, indices + header->index_count);
+        mesh.position_offset = glm::vec3(header->position_offset[0], header->position_offset[1], header->position_offset[2]);
+        mesh.position_scale = glm::vec3(header->position_scale[0], header->position_scale[1], header->position_scale[2]);
+        _readLods(header, mesh.lods);
+
+        const Meshlet *meshlets = (const Meshlet*)(data + header->meshlet_offset);
+        mesh.meshlets.assign(meshlets, meshlets + header->meshlet_count);
+        for (size_t i = 0; i < mesh.meshlets.size(); i++){
+            const Meshlet &meshlet = mesh.meshlets[i];
+            if (meshlet.first_index > header->index_count || meshlet.index_count > header->index_count - meshlet.first_index) return false;
+        }
+        return true;
+    }
+
+    std::string _compiledMeshPath(const std::string &filename){
+        size_t dot = filename.find_last_of('.');
+        size_t separator = filename.find_last_of("/\\");
+        if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) return filename + MESH_FILE_EXTENSION;
+        return filename.substr(0, dot) + MESH_FILE_EXTENSION;
+    }
+
+    bool _isCompiledMeshCurrent(const std::string &compiled, const std::string &source){
+        struct stat compiled_stat, source_stat;
+        if (stat(compiled.c_str(), &compiled_stat) != 0) return false;
+        //without a source the compiled mesh is all there is
+        if (stat(source.c_str(), &source_stat) != 0) return true;
+        return compiled_stat.st_mtime >= source_stat.st_mtime;
+    }
+}
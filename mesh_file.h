@@ -0,0 +1,51 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Compiled mesh files. A header with the vertex layout, then the vertex and index data,
+// aligned and ready for glBufferData, then the meshlets. The file is mapped and read straight from the mapping.
+// ------------------------------------------------ -------------------------------------------------
+
+#pragma once
+
+#include "mesh_loader.h"
+#include <stdint.h>
+
+#define MESH_FILE_MAGIC 0x4853454D // "MESH"
+#define MESH_FILE_VERSION 4
+#define MESH_FILE_EXTENSION ".mesh"
+
+// Blobs start on this boundary, counted from the start of the file.
+#define MESH_FILE_ALIGNMENT 64
+#define MESH_FILE_MAX_ATTRIBUTES 8
+
+namespace mesh{
+    // One vertex attribute, as passed to glVertexAttribPointer.
+    struct MeshFileAttribute{
+        uint32_t location, components, type, normalized, offset;
+    };
+
+    struct MeshFileHeader{
+        uint32_t magic, version;
+        uint32_t vertex_stride, attribute_count;
+        MeshFileAttribute attributes[MESH_FILE_MAX_ATTRIBUTES];
+        uint32_t vertex_count, index_count, index_type, reserved;
+        //decode of the packed positions, see PackedVertexFormat
+        float position_offset[3], position_scale[3];
+        //levels of detail, ranges of the index blob, see MeshLodChain
+        uint32_t lod_count, lod_first_index[MESH_LOD_COUNT], lod_index_count[MESH_LOD_COUNT];
+        uint64_t vertex_offset, vertex_size;
+        uint64_t index_offset, index_size;
+        uint64_t meshlet_offset, meshlet_count;
+    };
+
+    // Write a mesh, with every level of detail and its meshlets, as a compiled mesh. Returns false if the
+    // file can't be written.
+    bool saveMeshFile(const std::string &filename, const MeshData &mesh);
+
+    // Read a compiled mesh into memory without touching OpenGL, for uploadMesh. Returns false if the file is missing or
+    // not a valid compiled mesh of this version.
+    bool readMeshFile(const std::string &filename, MeshData &mesh);
+
+    // Where the compiled version of a source mesh lives: same path, MESH_FILE_EXTENSION extension.
+    std::string _compiledMeshPath(const std::string &filename);
+    // True if compiled exists and is not older than source.
+    bool _isCompiledMeshCurrent(const std::string &compiled, const std::string &source);
+}
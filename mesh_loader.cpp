@@ -8,6 +8,16 @@
 #pragma once
 
 #include "mesh_loader.h"
+#include "gl_state.h"
+#include "mapped_file.h"
+#include "mesh_file.h"
+#include "mesh_simplifier.h"
+#include "mesh_meshlet.h"
+#include "cpu_profiler.h"
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <thread>
 
 namespace mesh{
 	// Is a vertex format?
@@ -43,49 +53,130 @@ namespace mesh{
         return (*this);
     }
 
-	// Load a file type Obj (without NURBS without materials)
-	// Returns the arguments submitted by reference id vao OpenGL (Vertex Array Object) for vbo (Vertex Buffer Object) and Ibo (Index Buffer Object)
-	void loadObj(const std::string &filename, unsigned int &vao, unsigned int& vbo, unsigned int &ibo, unsigned int &num_indices){
-		// Load and indexes the file
-        std::vector<VertexFormat> vertices;
-        std::vector<unsigned int> indices;
-        _loadObjFile(filename, vertices, indices);
+    bool readObj(const std::string &filename, MeshData &mesh){
+        std::string compiled = _compiledMeshPath(filename);
+        if (_isCompiledMeshCurrent(compiled, filename) && readMeshFile(compiled, mesh)){
+            std::cout << "Mesh Loader : read compiled file " << compiled << std::endl;
+            return true;
+        }
 
-        std::cout << "Mesh Loader : loaded file " << filename << std::endl;
+        _compileObj(filename, compiled, mesh);
+        return !mesh.indices.empty();
+    }
 
-		// Create the necessary OpenGL drawing objects
+    void uploadMesh(const MeshData &mesh, unsigned int &vao, unsigned int& vbo, unsigned int &ibo, unsigned int &num_indices){
         unsigned int gl_vertex_array_object, gl_vertex_buffer_object, gl_index_buffer_object;
 
 		// Vertex array object -> object that represents a container for drawing state
         glGenVertexArrays(1, &gl_vertex_array_object);
-        glBindVertexArray(gl_vertex_array_object);
+        GLState::bindVertexArray(gl_vertex_array_object);
 
 		// Vertex buffer object -> object to hold our vertices
         glGenBuffers(1, &gl_vertex_buffer_object);
         glBindBuffer(GL_ARRAY_BUFFER, gl_vertex_buffer_object);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(VertexFormat), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size()*sizeof(PackedVertexFormat), mesh.vertices.data(), GL_STATIC_DRAW);
 
 		// Index buffer object -> object to hold our indexes
         glGenBuffers(1, &gl_index_buffer_object);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl_index_buffer_object);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size()*sizeof(unsigned int), mesh.indices.data(), GL_STATIC_DRAW);
 
 		// Link between attributes and pipeline; our data are interleaved.
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 3, GL_FLOAT, GL_TRUE, sizeof(VertexFormat), (void*)0);						//pos pipe 0
-        glEnableVertexAttribArray(7);
-        glVertexAttribPointer(7, 3, GL_FLOAT, GL_TRUE, sizeof(VertexFormat), (void*)(sizeof(float)* 3));		//normal pipe 1
-        glEnableVertexAttribArray(8);
-        glVertexAttribPointer(8, 2, GL_FLOAT, GL_TRUE, sizeof(VertexFormat), (void*)(2 * sizeof(float)* 3));	//texcoords pipe 2
+        _setPackedVertexAttributes();
 
         vao = gl_vertex_array_object;
         vbo = gl_vertex_buffer_object;
         ibo = gl_index_buffer_object;
-        num_indices = indices.size();
+        num_indices = mesh.indices.size();
+    }
+
+    void _compileObj(const std::string &filename, const std::string &compiled, MeshData &mesh){
+        std::vector<VertexFormat> vertices;
+        _loadObjFile(filename, vertices, mesh.indices);
+        if (mesh.indices.empty()) return;
+
+        std::cout << "Mesh Loader : loaded file " << filename << " (" << vertices.size() << " vertices, " << mesh.indices.size() / 3
+            << " triangles, ACMR " << _computeACMR(mesh.indices, vertices.size(), MESH_VERTEX_CACHE_SIZE) << ")" << std::endl;
+
+        //append the coarser levels of detail
+        _buildLodChain(vertices, mesh.indices, mesh.lods);
+        std::cout << "Mesh Loader : " << mesh.lods.count << " levels of detail,";
+        for (unsigned int i = 0; i < mesh.lods.count; i++) std::cout << " " << mesh.lods.index_count[i] / 3;
+        std::cout << " triangles" << std::endl;
+
+        //clusters of the full detail level, for culling
+        _buildMeshlets(vertices, mesh.indices, mesh.lods, mesh.meshlets);
+        if (!mesh.meshlets.empty()) std::cout << "Mesh Loader : " << mesh.meshlets.size() << " meshlets" << std::endl;
+
+        //pack the vertices for upload
+        _packVertices(vertices, mesh.vertices, mesh.position_offset, mesh.position_scale);
+
+        if (!saveMeshFile(compiled, mesh)){
+            std::cout << "Mesh Loader : could not write " << compiled << std::endl;
+        }
     }
 
     //-------------------------------------------------------------------------------------------------
 
+    //vertex packing
+    unsigned short _packUnorm16(float value){
+        return (unsigned short)(glm::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+    }
+    short _packSnorm16(float value){
+        return (short)floorf(glm::clamp(value, -1.0f, 1.0f) * 32767.0f + 0.5f);
+    }
+    glm::vec2 _encodeOctahedral(glm::vec3 normal){
+        float length = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+        if (length == 0) return glm::vec2(0, 0);
+        glm::vec2 p = glm::vec2(normal.x, normal.y) / length;
+        //fold the lower hemisphere over the diagonals
+        if (normal.z < 0){
+            p = glm::vec2((1 - fabsf(p.y)) * (p.x >= 0 ? 1.0f : -1.0f), (1 - fabsf(p.x)) * (p.y >= 0 ? 1.0f : -1.0f));
+        }
+        return p;
+    }
+    void _packVertices(const std::vector<VertexFormat> &vertices, std::vector<PackedVertexFormat> &packed,
+        glm::vec3 &position_offset, glm::vec3 &position_scale){
+        glm::vec3 minimum = glm::vec3(0, 0, 0), maximum = glm::vec3(0, 0, 0);
+        for (size_t i = 0; i < vertices.size(); i++){
+            glm::vec3 position = glm::vec3(vertices[i].position_x, vertices[i].position_y, vertices[i].position_z);
+            minimum = i ? glm::min(minimum, position) : position;
+            maximum = i ? glm::max(maximum, position) : position;
+        }
+        position_offset = minimum;
+        position_scale = maximum - minimum;
+
+        //flat sides keep scale 0, any unorm decodes to the offset
+        glm::vec3 inverse_scale = glm::vec3(position_scale.x > 0 ? 1 / position_scale.x : 0,
+            position_scale.y > 0 ? 1 / position_scale.y : 0, position_scale.z > 0 ? 1 / position_scale.z : 0);
+
+        packed.resize(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++){
+            const VertexFormat &vertex = vertices[i];
+            PackedVertexFormat &result = packed[i];
+            result.position[0] = _packUnorm16((vertex.position_x - minimum.x) * inverse_scale.x);
+            result.position[1] = _packUnorm16((vertex.position_y - minimum.y) * inverse_scale.y);
+            result.position[2] = _packUnorm16((vertex.position_z - minimum.z) * inverse_scale.z);
+            result.padding = 0;
+
+            glm::vec2 normal = _encodeOctahedral(glm::vec3(vertex.normal_x, vertex.normal_y, vertex.normal_z));
+            result.normal[0] = _packSnorm16(normal.x);
+            result.normal[1] = _packSnorm16(normal.y);
+
+            result.texcoord[0] = glm::packHalf1x16(vertex.texcoord_x);
+            result.texcoord[1] = glm::packHalf1x16(vertex.texcoord_y);
+        }
+    }
+    void _setPackedVertexAttributes(){
+        glEnableVertexAttribArray(6);
+        glVertexAttribPointer(6, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertexFormat), (void*)offsetof(PackedVertexFormat, position));	//pos pipe 0
+        glEnableVertexAttribArray(7);
+        glVertexAttribPointer(7, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertexFormat), (void*)offsetof(PackedVertexFormat, normal));			//normal pipe 1
+        glEnableVertexAttribArray(8);
+        glVertexAttribPointer(8, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertexFormat), (void*)offsetof(PackedVertexFormat, texcoord));	//texcoords pipe 2
+    }
+
+
     //helper funcs
     float _stringToFloat(const std::string &source){
         std::stringstream ss(source.c_str());
@@ -126,127 +217,434 @@ namespace mesh{
         _stringTokenize(aux, tokens);
     }
 
-	// Load only geometry from a file obj (not loaded: high order surfaces, materials, coordinated extra lines)
-	// Format: http://paulbourke.net/dataformats/obj/
-	// Calculate not normal or texture coordinates or tangent, but readable non-optimal performance (relative to other parsers ..)
-	// Consider geometry as a single object, so do not take into account or smoothing groups
-	void _loadObjFile(const std::string &filename, std::vector<VertexFormat> &vertices, std::vector<unsigned int> &indices){
-        //read the file
-        std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
-        if (!file.good()){
-            std::cout << "Mesh Loader: Obj file not found " << filename << " or no rights to open!" << std::endl;
-            std::terminate();
-        }
-
-        std::string line;
-        std::vector<std::string> tokens, facetokens;
-        std::vector<glm::vec3> positions;		positions.reserve(1000);
-        std::vector<glm::vec3> normals;		normals.reserve(1000);
-        std::vector<glm::vec2> texcoords;		texcoords.reserve(1000);
-        while (std::getline(file, line)){
-            //tokens line read
-            _stringTokenize(line, tokens);
-
-            //if I have nothing going on
-            if (tokens.size() == 0) continue;
-
-            //If I go further continue
-            if (tokens.size() > 0 && tokens[0].at(0) == '#') continue;
-
-            //if I have a vertex
-            if (tokens.size() > 3 && tokens[0] == "v") positions.push_back(glm::vec3(_stringToFloat(tokens[1]), _stringToFloat(tokens[2]), _stringToFloat(tokens[3])));
-
-            //if I have a normal
-            if (tokens.size() > 3 && tokens[0] == "vn") normals.push_back(glm::vec3(_stringToFloat(tokens[1]), _stringToFloat(tokens[2]), _stringToFloat(tokens[3])));
-
-            //if I have a texcoord
-            if (tokens.size() > 2 && tokens[0] == "vt") texcoords.push_back(glm::vec2(_stringToFloat(tokens[1]), _stringToFloat(tokens[2])));
-
-            //if I have a face (f + minimum three indexes)
-            if (tokens.size() >= 4 && tokens[0] == "f"){
-				// Use the first vertex of the face determine the format (v v/t v//n v/t/n) = (1 2 3 4)
-                unsigned int face_format = 0;
-                if (tokens[1].find("//") != std::string::npos) face_format = 3;
-                _faceTokenize(tokens[1], facetokens);
-                if (facetokens.size() == 3) face_format = 4; // vertices/texcoords/normal
-                else{
-                    if (facetokens.size() == 2){
-                        if (face_format != 3) face_format = 2;
+    //pointer based parsing, for the obj loader
+    //reads a float, without going through a string; accurate to the float precision
+    float _parseFloat(const char *&cursor, const char *end){
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        bool negative = false;
+        unsigned long long mantissa = 0;
+        int exponent = 0, digits = 0;
+
+        if (cursor < end && (*cursor == '-' || *cursor == '+')) negative = (*cursor++ == '-');
+
+        //integer part, digits past what 64 bits hold only scale the value
+        for (; cursor < end && *cursor >= '0' && *cursor <= '9'; cursor++){
+            if (digits < 19){
+                mantissa = mantissa * 10 + (*cursor - '0');
+                if (mantissa) digits++;
+            }
+            else exponent++;
+        }
+        //fractional part
+        if (cursor < end && *cursor == '.'){
+            for (cursor++; cursor < end && *cursor >= '0' && *cursor <= '9'; cursor++){
+                if (digits < 19){
+                    mantissa = mantissa * 10 + (*cursor - '0');
+                    if (mantissa) digits++;
+                    exponent--;
+                }
+            }
+        }
+        //exponent
+        if (cursor < end && (*cursor == 'e' || *cursor == 'E')){
+            cursor++;
+            int e = _parseInt(cursor, end);
+            exponent += (e > 400) ? 400 : ((e < -400) ? -400 : e);
+        }
+
+        double value = (double)mantissa;
+        if (exponent < 0){
+            for (; exponent < -22; exponent += 22) value /= 1e22;
+            value /= powers[-exponent];
+        }
+        else{
+            for (; exponent > 22; exponent -= 22) value *= 1e22;
+            value *= powers[exponent];
+        }
+        return (float)(negative ? -value : value);
+    }
+    //reads a signed int
+    int _parseInt(const char *&cursor, const char *end){
+        bool negative = false;
+        int result = 0;
+        if (cursor < end && (*cursor == '-' || *cursor == '+')) negative = (*cursor++ == '-');
+        for (; cursor < end && *cursor >= '0' && *cursor <= '9'; cursor++) result = result * 10 + (*cursor - '0');
+        return negative ? -result : result;
+    }
+    //skips spaces and tabs (and the \r of windows line ends), staying on the line
+    static inline void _skipSpaces(const char *&cursor, const char *end){
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) cursor++;
+    }
+    static inline float _readFloat(const char *&cursor, const char *end){
+        _skipSpaces(cursor, end);
+        return _parseFloat(cursor, end);
+    }
+    //obj indices start at 1, negative ones count back from the last element read
+    //negative ones are kept relative to the chunk start and flagged, until the chunk's offset is known
+    static inline int _encodeIndex(int index, size_t count, unsigned char flag, unsigned char &relative){
+        if (index > 0) return index - 1;
+        if (index == 0) return -1;
+        relative |= flag;
+        return (int)count + index;
+    }
+
+    //a face corner, indices into the position, texcoord and normal arrays (-1 when missing)
+    struct _ObjCorner{
+        int p, t, n;
+        unsigned char relative;
+    };
+    #define OBJ_RELATIVE_P 1
+    #define OBJ_RELATIVE_T 2
+    #define OBJ_RELATIVE_N 4
+
+    //what one thread reads from its part of the file, polygons already fanned into triangle corners
+    struct _ObjChunk{
+        const char *begin, *end;
+        std::vector<glm::vec3> positions, normals;
+        std::vector<glm::vec2> texcoords;
+        std::vector<_ObjCorner> corners;
+        size_t position_base, normal_base, texcoord_base;
+    };
+
+    static void _parseObjChunk(_ObjChunk &chunk){
+        CpuProfileZone zone("obj chunk");
+        const char *cursor = chunk.begin;
+        const char *end = chunk.end;
+
+        while (cursor < end){
+            const char *line_end = (const char*)memchr(cursor, '\n', end - cursor);
+            if (!line_end) line_end = end;
+
+            _skipSpaces(cursor, line_end);
+
+            //if I have a vertex, a normal or a texcoord
+            if (line_end - cursor > 1 && cursor[0] == 'v'){
+                if (cursor[1] == ' ' || cursor[1] == '\t'){
+                    cursor += 1;
+                    float x = _readFloat(cursor, line_end), y = _readFloat(cursor, line_end);
+                    chunk.positions.push_back(glm::vec3(x, y, _readFloat(cursor, line_end)));
+                }
+                else if (cursor[1] == 'n'){
+                    cursor += 2;
+                    float x = _readFloat(cursor, line_end), y = _readFloat(cursor, line_end);
+                    chunk.normals.push_back(glm::vec3(x, y, _readFloat(cursor, line_end)));
+                }
+                else if (cursor[1] == 't'){
+                    cursor += 2;
+                    float x = _readFloat(cursor, line_end);
+                    chunk.texcoords.push_back(glm::vec2(x, _readFloat(cursor, line_end)));
+                }
+            }
+
+            //if I have a face (v v/t v//n v/t/n per corner)
+            else if (line_end - cursor > 1 && cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t')){
+                //the first and the previous corner of this polygon
+                _ObjCorner first_corner = {}, previous_corner = {};
+                //where this face starts, to drop it if it has fewer than 3 corners
+                size_t face_start = chunk.corners.size();
+                unsigned int corner = 0;
+                cursor += 1;
+
+                for (;; corner++){
+                    _skipSpaces(cursor, line_end);
+                    if (cursor >= line_end || *cursor == '#') break;
+
+                    int p_index = _parseInt(cursor, line_end), t_index = 0, n_index = 0;
+                    if (cursor < line_end && *cursor == '/'){
+                        cursor++;
+                        if (cursor < line_end && *cursor != '/') t_index = _parseInt(cursor, line_end);
+                        if (cursor < line_end && *cursor == '/'){
+                            cursor++;
+                            n_index = _parseInt(cursor, line_end);
+                        }
+                    }
+                    //skip whatever else is glued to the corner
+                    while (cursor < line_end && *cursor != ' ' && *cursor != '\t' && *cursor != '\r') cursor++;
+
+                    _ObjCorner current;
+                    current.relative = 0;
+                    current.p = _encodeIndex(p_index, chunk.positions.size(), OBJ_RELATIVE_P, current.relative);
+                    current.t = _encodeIndex(t_index, chunk.texcoords.size(), OBJ_RELATIVE_T, current.relative);
+                    current.n = _encodeIndex(n_index, chunk.normals.size(), OBJ_RELATIVE_N, current.relative);
+
+                    //add corners
+                    if (corner < 3){
+                        if (corner == 0) first_corner = current;
+                        chunk.corners.push_back(current);
                     }
                     else{
-                        face_format = 1; //only vertices
+						// Polygon => triangle predecessor last vertex and 0 relatively new addition to vertecsi polygon (independent clockwise)
+                        chunk.corners.push_back(first_corner);
+                        chunk.corners.push_back(previous_corner);
+                        chunk.corners.push_back(current);
                     }
-                }
+                    previous_corner = current;
+                }//end for
 
-                //the first index of this polygon
-                unsigned int index_of_first_vertex_of_face = -1;
+                //a point or a line would shift every later triangle
+                if (corner < 3) chunk.corners.resize(face_start);
+            }//end face
 
-                for (unsigned int num_token = 1; num_token<tokens.size(); num_token++){
-                    if (tokens[num_token].at(0) == '#') break;					
-                    _faceTokenize(tokens[num_token], facetokens);
-                    if (face_format == 1){
-                        //only position
-                        int p_index = _stringToInt(facetokens[0]);
-                        if (p_index>0) p_index -= 1;								//obj has 1...n indices
-                        else p_index = positions.size() + p_index;				//index negativ
+            cursor = line_end + 1;
+        }//end while
+    }
 
-                        vertices.push_back(VertexFormat(positions[p_index].x, positions[p_index].y, positions[p_index].z));
-                    }
-                    else if (face_format == 2){
-                        // position and texcoord
-                        int p_index = _stringToInt(facetokens[0]);
-                        if (p_index > 0) p_index -= 1;								//obj has 1...n indices
-                        else p_index = positions.size() + p_index;				//index negativ
+    //copies the chunk's elements to their place in the merged arrays and makes its corners absolute
+    static void _mergeObjChunk(_ObjChunk &chunk, std::vector<glm::vec3> &positions, std::vector<glm::vec3> &normals, std::vector<glm::vec2> &texcoords){
+        if (!chunk.positions.empty()) memcpy(&positions[chunk.position_base], &chunk.positions[0], chunk.positions.size() * sizeof(glm::vec3));
+        if (!chunk.normals.empty()) memcpy(&normals[chunk.normal_base], &chunk.normals[0], chunk.normals.size() * sizeof(glm::vec3));
+        if (!chunk.texcoords.empty()) memcpy(&texcoords[chunk.texcoord_base], &chunk.texcoords[0], chunk.texcoords.size() * sizeof(glm::vec2));
+
+        //out of range attributes become missing
+        int p_count = (int)positions.size(), t_count = (int)texcoords.size(), n_count = (int)normals.size();
+        for (size_t i = 0; i < chunk.corners.size(); i++){
+            _ObjCorner &corner = chunk.corners[i];
+            if (corner.relative & OBJ_RELATIVE_P) corner.p += (int)chunk.position_base;
+            if (corner.relative & OBJ_RELATIVE_T) corner.t += (int)chunk.texcoord_base;
+            if (corner.relative & OBJ_RELATIVE_N) corner.n += (int)chunk.normal_base;
+            if (corner.p < 0 || corner.p >= p_count) corner.p = -1;
+            if (corner.t < 0 || corner.t >= t_count) corner.t = -1;
+            if (corner.n < 0 || corner.n >= n_count) corner.n = -1;
+        }
+    }
 
-                        int t_index = _stringToInt(facetokens[1]);
-                        if (t_index > 0) t_index -= 1;								//obj has 1...n indices
-                        else t_index = texcoords.size() + t_index;				//index negativ
+    //obj corners that share position, texcoord and normal indices become one vertex
+    //open addressing table from the (p, t, n) triple to the vertex index, grows at half load
+    struct _CornerTable{
+        struct Slot{ unsigned int p, t, n, vertex; };
+        std::vector<Slot> slots;
+        unsigned int count;
 
-                        vertices.push_back(VertexFormat(positions[p_index].x, positions[p_index].y, positions[p_index].z, texcoords[t_index].x, texcoords[t_index].y));
-                    }
-                    else if (face_format == 3){
-                        //position and normal
-                        int p_index = _stringToInt(facetokens[0]);
-                        if (p_index > 0) p_index -= 1;								//obj has 1...n indices
-                        else p_index = positions.size() + p_index;				//index negativ
+        _CornerTable() : slots(1024), count(0){
+            for (size_t i = 0; i < slots.size(); i++) slots[i].vertex = NO_VERTEX;
+        }
+        static const unsigned int NO_VERTEX = 0xFFFFFFFF;
 
-                        int n_index = _stringToInt(facetokens[1]);
-                        if (n_index > 0) n_index -= 1;								//obj has 1...n indices
-                        else n_index = normals.size() + n_index;					//index negativ
+        static size_t hash(unsigned int p, unsigned int t, unsigned int n){
+            unsigned long long h = p * 0x9E3779B97F4A7C15ull;
+            h ^= (t + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2)) * 0xBF58476D1CE4E5B9ull;
+            h ^= (n + 0x94D049BB133111EBull + (h << 6) + (h >> 2)) * 0x94D049BB133111EBull;
+            return (size_t)(h ^ (h >> 31));
+        }
+        //returns the slot holding the triple, or the empty one where it goes
+        Slot &find(unsigned int p, unsigned int t, unsigned int n){
+            size_t mask = slots.size() - 1;
+            for (size_t i = hash(p, t, n) & mask;; i = (i + 1) & mask){
+                Slot &slot = slots[i];
+                if (slot.vertex == NO_VERTEX || (slot.p == p && slot.t == t && slot.n == n)) return slot;
+            }
+        }
+        void grow(){
+            std::vector<Slot> old(slots.size() * 2);
+            old.swap(slots);
+            for (size_t i = 0; i < slots.size(); i++) slots[i].vertex = NO_VERTEX;
+            for (size_t i = 0; i < old.size(); i++){
+                if (old[i].vertex != NO_VERTEX) find(old[i].p, old[i].t, old[i].n) = old[i];
+            }
+        }
+    };
+
+    //average vertex shader invocations per triangle, for a fifo post transform cache
+    float _computeACMR(const std::vector<unsigned int> &indices, unsigned int vertex_count, unsigned int cache_size){
+        std::vector<unsigned int> cached_at(vertex_count, 0);
+        unsigned int time = cache_size + 1, misses = 0;
+        if (indices.size() < 3) return 0;
+        for (size_t i = 0; i < indices.size(); i++){
+            unsigned int v = indices[i];
+            if (time - cached_at[v] > cache_size){
+                cached_at[v] = time++;
+                misses++;
+            }
+        }
+        return misses / (float)(indices.size() / 3);
+    }
 
-                        vertices.push_back(VertexFormat(positions[p_index].x, positions[p_index].y, positions[p_index].z, normals[n_index].x, normals[n_index].y, normals[n_index].z));
-                    }
-                    else{
-                        //normal position & texcoord
-                        int p_index = _stringToInt(facetokens[0]);
-                        if (p_index > 0) p_index -= 1;								//obj has 1...n indices
-                        else p_index = positions.size() + p_index;				//index negativ
+    //tipsify: Sander, Nehab, Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007
+    //fans around one vertex at a time, moving to the neighbour that is still cached and has the fewest
+    //live triangles left; linear in the triangle count, keeps the winding of every triangle
+    void _optimizeVertexCache(std::vector<unsigned int> &indices, unsigned int vertex_count, unsigned int cache_size){
+        size_t triangle_count = indices.size() / 3;
+        if (triangle_count == 0) return;
+
+        //triangles around each vertex, as offsets into one array
+        std::vector<unsigned int> live(vertex_count, 0), offsets(vertex_count + 1, 0), adjacency(triangle_count * 3);
+        for (size_t i = 0; i < triangle_count * 3; i++) live[indices[i]]++;
+        for (unsigned int v = 0; v < vertex_count; v++) offsets[v + 1] = offsets[v] + live[v];
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < triangle_count * 3; i++) adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+        std::vector<unsigned int> cached_at(vertex_count, 0), dead_ends, candidates, result;
+        std::vector<bool> emitted(triangle_count, false);
+        unsigned int time = cache_size + 1, cursor = 1;
+        int fan = 0;
+        result.reserve(triangle_count * 3);
+        dead_ends.reserve(triangle_count * 3);
+
+        while (fan >= 0){
+            candidates.clear();
+
+            //emit every triangle left around the fanning vertex
+            for (unsigned int a = offsets[fan]; a < offsets[fan + 1]; a++){
+                unsigned int t = adjacency[a];
+                if (emitted[t]) continue;
+                emitted[t] = true;
+
+                for (unsigned int k = 0; k < 3; k++){
+                    unsigned int v = indices[t * 3 + k];
+                    result.push_back(v);
+                    dead_ends.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (time - cached_at[v] > cache_size) cached_at[v] = time++;
+                }
+            }
+
+            //next fan: the candidate that will still be cached after its fan, and entered the cache earliest
+            fan = -1;
+            int best = -1;
+            for (size_t c = 0; c < candidates.size(); c++){
+                unsigned int v = candidates[c];
+                if (live[v] == 0) continue;
+                int priority = 0;
+                if (time - cached_at[v] + 2 * live[v] <= cache_size) priority = time - cached_at[v];
+                if (priority > best){
+                    best = priority;
+                    fan = v;
+                }
+            }
+
+            //dead end: go back to a recently used vertex, or scan ahead for any with triangles left
+            while (fan < 0 && !dead_ends.empty()){
+                unsigned int v = dead_ends.back();
+                dead_ends.pop_back();
+                if (live[v] > 0) fan = v;
+            }
+            for (; fan < 0 && cursor < vertex_count; cursor++){
+                if (live[cursor] > 0) fan = cursor;
+            }
+        }
+
+        indices.swap(result);
+    }
 
-                        int t_index = _stringToInt(facetokens[1]);
-                        if (t_index > 0) t_index -= 1;								//obj has 1...n indices
-                        else t_index = normals.size() + t_index;					//index negativ
+    //renumbers vertices in the order the indices first use them, so vertex fetch walks the buffer forward
+    void _optimizeVertexFetch(std::vector<VertexFormat> &vertices, std::vector<unsigned int> &indices){
+        const unsigned int unused = 0xFFFFFFFF;
+        std::vector<unsigned int> remap(vertices.size(), unused);
+        std::vector<VertexFormat> result;
+        result.reserve(vertices.size());
+
+        for (size_t i = 0; i < indices.size(); i++){
+            unsigned int &index = indices[i];
+            if (remap[index] == unused){
+                remap[index] = (unsigned int)result.size();
+                result.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
 
-                        int n_index = _stringToInt(facetokens[2]);
-                        if (n_index > 0) n_index -= 1;								//obj has 1...n indices
-                        else n_index = normals.size() + n_index;					//index negativ
+        vertices.swap(result);
+    }
 
-                        vertices.push_back(VertexFormat(positions[p_index].x, positions[p_index].y, positions[p_index].z, normals[n_index].x, normals[n_index].y, normals[n_index].z, texcoords[t_index].x, texcoords[t_index].y));
-                    }
+	// Load only geometry from a file obj (not loaded: high order surfaces, materials, coordinated extra lines)
+	// Format: http://paulbourke.net/dataformats/obj/
+	// Calculate not normal or texture coordinates or tangent
+	// Consider geometry as a single object, so do not take into account or smoothing groups
+	// The file is mapped and split at line ends into chunks parsed in parallel, nothing is allocated per line
+	// Corners are deduplicated, then triangles and vertices are reordered for the vertex caches
+	void _loadObjFile(const std::string &filename, std::vector<VertexFormat> &vertices, std::vector<unsigned int> &indices){
+        CpuProfileZone zone("obj load");
 
-                    //add indexes
-                    if (num_token < 4){
-                        if (num_token == 1) index_of_first_vertex_of_face = vertices.size() - 1;
-                        //doar triunghiuri f 0 1 2 3 (4 indecsi, primul e ocupat de f)
-                        indices.push_back(vertices.size() - 1);
-                    }
-                    else{
-						// Polygon => triangle predecessor last vertex and 0 relatively new addition to vertecsi polygon (independent clockwise)
-                        indices.push_back(index_of_first_vertex_of_face);
-                        indices.push_back(vertices.size() - 2);
-                        indices.push_back(vertices.size() - 1);
+        //map the file
+        MappedFile file(filename);
+        if (!file.isOpen()){
+            std::cout << "Mesh Loader: Obj file not found " << filename << " or no rights to open!" << std::endl;
+            return;
+        }
+
+        const char *begin = file.getData();
+        const char *end = begin + file.getSize();
+
+        //one chunk per core, none smaller than MESH_OBJ_CHUNK_SIZE; every chunk but the last ends after a line end
+        size_t chunk_count = std::min((size_t)std::max(std::thread::hardware_concurrency(), 1u), file.getSize() / MESH_OBJ_CHUNK_SIZE + 1);
+        std::vector<_ObjChunk> chunks(chunk_count);
+        const char *chunk_begin = begin;
+        for (size_t i = 0; i < chunk_count; i++){
+            const char *chunk_end = end;
+            if (i + 1 < chunk_count){
+                chunk_end = std::max(chunk_begin, begin + file.getSize() * (i + 1) / chunk_count);
+                const char *line_end = (const char*)memchr(chunk_end, '\n', end - chunk_end);
+                chunk_end = line_end ? line_end + 1 : end;
+            }
+            chunks[i].begin = chunk_begin;
+            chunks[i].end = chunk_end;
+            chunk_begin = chunk_end;
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < chunk_count; i++) threads.push_back(std::thread(_parseObjChunk, std::ref(chunks[i])));
+        _parseObjChunk(chunks[0]);
+        for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+        threads.clear();
+
+        //prefix sums of the element counts give each chunk's offset in the merged arrays
+        size_t position_count = 0, normal_count = 0, texcoord_count = 0;
+        for (size_t i = 0; i < chunk_count; i++){
+            chunks[i].position_base = position_count;
+            chunks[i].normal_base = normal_count;
+            chunks[i].texcoord_base = texcoord_count;
+            position_count += chunks[i].positions.size();
+            normal_count += chunks[i].normals.size();
+            texcoord_count += chunks[i].texcoords.size();
+        }
+        std::vector<glm::vec3> positions(position_count), normals(normal_count);
+        std::vector<glm::vec2> texcoords(texcoord_count);
+
+        for (size_t i = 1; i < chunk_count; i++){
+            threads.push_back(std::thread(_mergeObjChunk, std::ref(chunks[i]), std::ref(positions), std::ref(normals), std::ref(texcoords)));
+        }
+        _mergeObjChunk(chunks[0], positions, normals, texcoords);
+        for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+        //reuse the vertex of every corner seen before, in file order
+        {
+            CpuProfileZone dedup_zone("obj deduplication");
+            _CornerTable corners;
+            for (size_t c = 0; c < chunk_count; c++){
+                std::vector<_ObjCorner> &chunk_corners = chunks[c].corners;
+                for (size_t i = 0; i < chunk_corners.size(); i++){
+                    unsigned int p = (unsigned int)chunk_corners[i].p, t = (unsigned int)chunk_corners[i].t, n = (unsigned int)chunk_corners[i].n;
+
+                    _CornerTable::Slot *slot = &corners.find(p, t, n);
+                    if (slot->vertex == _CornerTable::NO_VERTEX){
+                        //missing attributes stay zero
+                        VertexFormat vertex;
+                        if (p != _CornerTable::NO_VERTEX){
+                            vertex.position_x = positions[p].x; vertex.position_y = positions[p].y; vertex.position_z = positions[p].z;
+                        }
+                        if (n != _CornerTable::NO_VERTEX){
+                            vertex.normal_x = normals[n].x; vertex.normal_y = normals[n].y; vertex.normal_z = normals[n].z;
+                        }
+                        if (t != _CornerTable::NO_VERTEX){
+                            vertex.texcoord_x = texcoords[t].x; vertex.texcoord_y = texcoords[t].y;
+                        }
+                        vertices.push_back(vertex);
+
+                        slot->p = p; slot->t = t; slot->n = n;
+                        slot->vertex = (unsigned int)(vertices.size() - 1);
+                        indices.push_back(slot->vertex);
+                        if (++corners.count * 2 > corners.slots.size()) corners.grow();
                     }
-                }//end for
-            }//end face
-        }//end while
+                    else indices.push_back(slot->vertex);
+                }
+                //free the chunk as soon as it is merged
+                std::vector<_ObjCorner>().swap(chunk_corners);
+            }
+        }
+
+        CpuProfileZone optimize_zone("obj optimization");
+        _optimizeVertexCache(indices, vertices.size(), MESH_VERTEX_CACHE_SIZE);
+        _optimizeVertexFetch(vertices, indices);
     }
 }
\ No newline at end of file
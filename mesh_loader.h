@@ -11,12 +11,32 @@
 #include "glm\glm.hpp"
 #include "glm\gtc\type_ptr.hpp"
 #include "glm\gtc\matrix_transform.hpp"
+#include "glm\gtc\packing.hpp"
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <sstream>
 
+// Post transform vertex cache size the triangle order is optimized for. Hardware caches are larger or
+// batch based, a small fifo still orders well for them.
+#define MESH_VERTEX_CACHE_SIZE 16
+
+// Levels of detail built for every loaded mesh. Each level keeps about MESH_LOD_RATIO of the previous
+// one's triangles, levels under MESH_LOD_MIN_TRIANGLES are not built.
+#define MESH_LOD_COUNT 4
+#define MESH_LOD_RATIO 0.25f
+#define MESH_LOD_MIN_TRIANGLES 16
+
+// Meshlets, clusters of neighbouring triangles culled together (mesh_meshlet.h). Meshes with fewer
+// than MESH_MESHLET_MIN_TRIANGLES at full detail don't get any and are drawn whole.
+#define MESH_MESHLET_MAX_VERTICES 64
+#define MESH_MESHLET_MAX_TRIANGLES 124
+#define MESH_MESHLET_MIN_TRIANGLES 4096
+
+// Smallest part of an obj file given to one parsing thread, smaller files are parsed by fewer threads.
+#define MESH_OBJ_CHUNK_SIZE (4 * 1024 * 1024)
+
 namespace mesh{
     struct VertexFormat{
         float position_x, position_y, position_z;
@@ -30,9 +50,46 @@ namespace mesh{
         VertexFormat operator=(const VertexFormat &rhs);
     };
 
-	// Load a file type Obj (without NURBS or materials)
-	// Returns the arguments submitted by reference id vao OpenGL (Vertex Array Object) for vbo (Vertex Buffer Object) and Ibo (Index Buffer Object)
-	void loadObj(const std::string &filename, unsigned int &vao, unsigned int& vbo, unsigned int &ibo, unsigned int &num_indices);
+    // Levels of detail, as ranges of one index buffer over the same vertices. Level 0 is the full mesh.
+    struct MeshLodChain{
+        unsigned int count;
+        unsigned int first_index[MESH_LOD_COUNT], index_count[MESH_LOD_COUNT];
+    };
+
+    // A range of the full detail indices, with the bounding sphere of its vertices and the cone of its
+    // triangle normals, cone_cutoff being the sine of the cone's half angle (1 when it can't be culled).
+    struct Meshlet{
+        unsigned int first_index, index_count;
+        float center[3], radius;
+        float cone_axis[3], cone_cutoff;
+    };
+
+    // What is uploaded, 16 bytes instead of 32: the position as 16 bit unorms inside the mesh bounds, the
+    // normal octahedral encoded in two 16 bit snorms, half float texcoords. min.vert and depth.vert decode
+    // the position as position_offset + position_scale * position.
+    struct PackedVertexFormat{
+        unsigned short position[3], padding;
+        short normal[2];
+        unsigned short texcoord[2];
+    };
+
+    // A mesh in memory, packed and with its levels of detail, ready for uploadMesh.
+    struct MeshData{
+        std::vector<PackedVertexFormat> vertices;
+        std::vector<unsigned int> indices;
+        glm::vec3 position_offset, position_scale;
+        MeshLodChain lods;
+        std::vector<Meshlet> meshlets;
+    };
+
+	// Load a file type Obj (without NURBS or materials), in two steps, for loading on other threads (asset_manager.h)
+	// readObj does everything but OpenGL and is safe on any thread, returns false if nothing could be read
+	// It reads the compiled mesh next to the file instead, when it is not older, and compiles it otherwise (mesh_file.h)
+	// The vertices are packed, position_offset and position_scale decode their positions
+	// The indices hold every level of detail, lods has their ranges
+	bool readObj(const std::string &filename, MeshData &mesh);
+	// uploadMesh creates the OpenGL objects, on the thread owning the context
+	void uploadMesh(const MeshData &mesh, unsigned int &vao, unsigned int& vbo, unsigned int &ibo, unsigned int &num_indices);
 
 	//-------------------------------------------------------------------------------------------------
 
@@ -44,10 +101,36 @@ namespace mesh{
     void _stringTokenize(const std::string &source, std::vector<std::string> &tokens);
     //variant for faces
     void _faceTokenize(const std::string &source, std::vector<std::string> &tokens);
+    //pointer based variants, advance cursor past what they read and stop at end
+    float _parseFloat(const char *&cursor, const char *end);
+    int _parseInt(const char *&cursor, const char *end);
+
+    //quantization, shared with the terrain
+    unsigned short _packUnorm16(float value);
+    short _packSnorm16(float value);
+    //maps a unit vector to the [-1, 1] square, decoded by decodeOctahedral in min.vert
+    glm::vec2 _encodeOctahedral(glm::vec3 normal);
+    //packs vertices relative to their bounds, returned as offset (minimum) and scale (size)
+    void _packVertices(const std::vector<VertexFormat> &vertices, std::vector<PackedVertexFormat> &packed,
+        glm::vec3 &position_offset, glm::vec3 &position_scale);
+    //sets the attribute pointers for PackedVertexFormat on the bound vertex array and buffer
+    void _setPackedVertexAttributes();
+    //parses an obj file, builds its levels of detail and meshlets, packs it and writes the compiled mesh
+    void _compileObj(const std::string &filename, const std::string &compiled, MeshData &mesh);
+
+    //reorders triangles for the post transform vertex cache (tipsify), keeping their winding
+    void _optimizeVertexCache(std::vector<unsigned int> &indices, unsigned int vertex_count, unsigned int cache_size);
+    //reorders vertices in first use order and remaps the indices, for vertex fetch locality
+    void _optimizeVertexFetch(std::vector<VertexFormat> &vertices, std::vector<unsigned int> &indices);
+    //average cache misses per triangle for a fifo cache, 0.5 is ideal for a regular grid and 3 the worst
+    float _computeACMR(const std::vector<unsigned int> &indices, unsigned int vertex_count, unsigned int cache_size);
 
 	// Load only geometry from a file obj (not loaded: high order surfaces, materials, coordinated extra lines)
 	// Format: http://paulbourke.net/dataformats/obj/
-	// Calculate not normal or texture coordinates or tangent, but readable non-optimal performance (relative to other parsers ..)
+	// Calculate not normal or texture coordinates or tangent
 	// Consider geometry as a single object, so do not take into account or smoothing groups
+	// The file is mapped and split at line ends into chunks parsed in parallel, nothing is allocated per line
+	// Corners are deduplicated, then triangles and vertices are reordered for the vertex caches
+	// A file that can't be opened leaves vertices and indices untouched
 	void _loadObjFile(const std::string &filename, std::vector<VertexFormat> &vertices, std::vector<unsigned int> &indices);
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Meshlets. The full detail triangles of large meshes are split into small clusters, each
+// with a bounding sphere and a normal cone, so whole clusters facing away from the eye or outside the
+// frustum are skipped on the CPU and the rest is drawn with one multi-draw.
+// ------------------------------------------------ -------------------------------------------------
+
+#include "mesh_meshlet.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace mesh{
+    //bounds of the triangles in indices[first, first + count)
+    static Meshlet _boundMeshlet(const std::vector<VertexFormat> &vertices, const std::vector<unsigned int> &indices,
+        unsigned int first, unsigned int count){
+        Meshlet meshlet;
+        meshlet.first_index = first;
+        meshlet.index_count = count;
+
+        //sphere around the middle of the box
+        glm::vec3 minimum = glm::vec3(FLT_MAX), maximum = glm::vec3(-FLT_MAX);
+        for (unsigned int i = first; i < first + count; i++){
+            const VertexFormat &v = vertices[indices[i]];
+            glm::vec3 p = glm::vec3(v.position_x, v.position_y, v.position_z);
+            minimum = glm::min(minimum, p);
+            maximum = glm::max(maximum, p);
+        }
+        glm::vec3 center = (minimum + maximum) * 0.5f;
+        float radius = 0;
+        for (unsigned int i = first; i < first + count; i++){
+            const VertexFormat &v = vertices[indices[i]];
+            radius = std::max(radius, glm::length(glm::vec3(v.position_x, v.position_y, v.position_z) - center));
+        }
+
+        //cone around the average face normal, as wide as the normal furthest from it
+        std::vector<glm::vec3> normals;
+        glm::vec3 axis = glm::vec3(0);
+        for (unsigned int i = first; i < first + count; i += 3){
+            const VertexFormat &a = vertices[indices[i]], &b = vertices[indices[i + 1]], &c = vertices[indices[i + 2]];
+            glm::vec3 pa = glm::vec3(a.position_x, a.position_y, a.position_z);
+            glm::vec3 normal = glm::cross(glm::vec3(b.position_x, b.position_y, b.position_z) - pa,
+                glm::vec3(c.position_x, c.position_y, c.position_z) - pa);
+            float length = glm::length(normal);
+            //degenerate triangles are never drawn, they don't widen the cone
+            if (length == 0) continue;
+            normals.push_back(normal / length);
+            axis += normal / length;
+        }
+
+        float cutoff = 1;
+        if (glm::length(axis) > 0){
+            axis = glm::normalize(axis);
+            float min_dot = 1;
+            for (size_t i = 0; i < normals.size(); i++) min_dot = std::min(min_dot, glm::dot(axis, normals[i]));
+            //from a cone wider than a half space some triangle always faces the eye
+            if (min_dot > 0) cutoff = sqrtf(1 - min_dot * min_dot);
+        }
+
+        for (int k = 0; k < 3; k++){
+            meshlet.center[k] = center[k];
+            meshlet.cone_axis[k] = axis[k];
+        }
+        meshlet.radius = radius;
+        meshlet.cone_cutoff = cutoff;
+        return meshlet;
+    }
+
+    void _buildMeshlets(const std::vector<VertexFormat> &vertices, const std::vector<unsigned int> &indices, const MeshLodChain &lods,
+        std::vector<Meshlet> &meshlets){
+        meshlets.clear();
+        if (lods.count == 0 || lods.index_count[0] < MESH_MESHLET_MIN_TRIANGLES * 3) return;
+
+        CpuProfileZone zone("meshlet build");
+        unsigned int begin = lods.first_index[0], end = begin + lods.index_count[0];
+
+        //which meshlet last used each vertex, to count the vertices of the open one
+        std::vector<unsigned int> used(vertices.size(), ~0u);
+        unsigned int first = begin, vertex_count = 0;
+
+        for (unsigned int i = begin; i < end; i += 3){
+            unsigned int id = (unsigned int)meshlets.size();
+            unsigned int added = 0;
+            for (int k = 0; k < 3; k++) added += used[indices[i + k]] != id;
+
+            //close the open meshlet if the triangle doesn't fit
+            if (vertex_count + added > MESH_MESHLET_MAX_VERTICES || (i - first) / 3 == MESH_MESHLET_MAX_TRIANGLES){
+                meshlets.push_back(_boundMeshlet(vertices, indices, first, i - first));
+                id++;
+                first = i;
+                vertex_count = 0;
+            }
+
+            for (int k = 0; k < 3; k++){
+                if (used[indices[i + k]] != id){
+                    used[indices[i + k]] = id;
+                    vertex_count++;
+                }
+            }
+        }
+        if (first < end) meshlets.push_back(_boundMeshlet(vertices, indices, first, end - first));
+    }
+
+    void cullMeshlets(const std::vector<Meshlet> &meshlets, const glm::mat4 &object_to_clip, glm::vec3 camera,
+        std::vector<GLsizei> &counts, std::vector<const void*> &offsets){
+        //frustum planes in object space (Gribb, Hartmann), normalized so spheres can be tested against them
+        glm::vec4 planes[6];
+        for (int k = 0; k < 3; k++){
+            glm::vec4 row = glm::vec4(object_to_clip[0][k], object_to_clip[1][k], object_to_clip[2][k], object_to_clip[3][k]);
+            glm::vec4 w = glm::vec4(object_to_clip[0][3], object_to_clip[1][3], object_to_clip[2][3], object_to_clip[3][3]);
+            planes[k * 2] = w + row;
+            planes[k * 2 + 1] = w - row;
+        }
+        for (int p = 0; p < 6; p++) planes[p] = planes[p] * (1.0f / glm::length(glm::vec3(planes[p])));
+
+        unsigned int merged_end = ~0u;
+        for (size_t m = 0; m < meshlets.size(); m++){
+            const Meshlet &meshlet = meshlets[m];
+            glm::vec3 center = glm::vec3(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+
+            bool outside = false;
+            for (int p = 0; p < 6 && !outside; p++){
+                outside = glm::dot(glm::vec3(planes[p]), center) + planes[p].w < -meshlet.radius;
+            }
+            if (outside) continue;
+
+            //every triangle faces away when the eye is behind the whole cone, widened by the sphere
+            glm::vec3 to_center = center - camera;
+            glm::vec3 axis = glm::vec3(meshlet.cone_axis[0], meshlet.cone_axis[1], meshlet.cone_axis[2]);
+            if (glm::dot(to_center, axis) >= meshlet.cone_cutoff * glm::length(to_center) + meshlet.radius) continue;
+
+            if (meshlet.first_index == merged_end){
+                counts.back() += meshlet.index_count;
+            }
+            else{
+                counts.push_back(meshlet.index_count);
+                offsets.push_back((const void*)(meshlet.first_index * sizeof(unsigned int)));
+            }
+            merged_end = meshlet.first_index + meshlet.index_count;
+        }
+    }
+}
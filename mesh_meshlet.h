@@ -0,0 +1,24 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Meshlets. The full detail triangles of large meshes are split into small clusters, each
+// with a bounding sphere and a normal cone, so whole clusters facing away from the eye or outside the
+// frustum are skipped on the CPU and the rest is drawn with one multi-draw.
+// ------------------------------------------------ -------------------------------------------------
+
+#pragma once
+
+#include "mesh_loader.h"
+
+namespace mesh{
+    // Split the full detail level (lods.first_index[0], lods.index_count[0]) into meshlets of up to
+    // MESH_MESHLET_MAX_VERTICES vertices and MESH_MESHLET_MAX_TRIANGLES triangles. Triangles are taken in
+    // index order, which the vertex cache optimization already keeps local, so every meshlet is a
+    // contiguous range. Leaves meshlets empty for meshes under MESH_MESHLET_MIN_TRIANGLES.
+    void _buildMeshlets(const std::vector<VertexFormat> &vertices, const std::vector<unsigned int> &indices, const MeshLodChain &lods,
+        std::vector<Meshlet> &meshlets);
+
+    // Append the index ranges of the meshlets that may be visible, as glMultiDrawElements counts and byte
+    // offsets, merging neighbouring ranges. object_to_clip is the model view projection, camera the eye
+    // position in object space.
+    void cullMeshlets(const std::vector<Meshlet> &meshlets, const glm::mat4 &object_to_clip, glm::vec3 camera,
+        std::vector<GLsizei> &counts, std::vector<const void*> &offsets);
+}
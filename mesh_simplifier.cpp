@@ -0,0 +1,236 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Mesh simplification and level of detail chains. Edges are collapsed in order of their
+// quadric error (Garland, Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997), always
+// onto an existing vertex, so every level indexes the same vertex buffer.
+// ------------------------------------------------ -------------------------------------------------
+
+#include "mesh_simplifier.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+
+namespace mesh{
+    //symmetric 4x4 matrix, the sum of squared distances to a set of planes
+    struct _Quadric{
+        double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    };
+
+    static void _addPlane(_Quadric &q, glm::vec3 normal, float distance, double weight){
+        double a = normal.x, b = normal.y, c = normal.z, d = distance;
+        q.a2 += weight * a * a; q.ab += weight * a * b; q.ac += weight * a * c; q.ad += weight * a * d;
+        q.b2 += weight * b * b; q.bc += weight * b * c; q.bd += weight * b * d;
+        q.c2 += weight * c * c; q.cd += weight * c * d;
+        q.d2 += weight * d * d;
+    }
+    static void _addQuadric(_Quadric &q, const _Quadric &other){
+        q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+        q.b2 += other.b2; q.bc += other.bc; q.bd += other.bd;
+        q.c2 += other.c2; q.cd += other.cd;
+        q.d2 += other.d2;
+    }
+    static double _quadricError(const _Quadric &q, glm::vec3 p){
+        double x = p.x, y = p.y, z = p.z;
+        return q.a2 * x * x + 2 * q.ab * x * y + 2 * q.ac * x * z + 2 * q.ad * x
+            + q.b2 * y * y + 2 * q.bc * y * z + 2 * q.bd * y
+            + q.c2 * z * z + 2 * q.cd * z
+            + q.d2;
+    }
+
+    struct _Collapse{
+        unsigned int from, to;
+        double cost;
+        bool operator<(const _Collapse &other) const{ return cost < other.cost; }
+    };
+
+    void _simplifyMesh(const std::vector<VertexFormat> &vertices, const std::vector<unsigned int> &indices,
+        size_t target_index_count, std::vector<unsigned int> &result){
+        CpuProfileZone zone("mesh simplification");
+        size_t vertex_count = vertices.size();
+        size_t triangle_count = indices.size() / 3;
+        unsigned int i, k;
+
+        std::vector<glm::vec3> positions(vertex_count), normals(vertex_count);
+        for (i = 0; i < vertex_count; i++){
+            positions[i] = glm::vec3(vertices[i].position_x, vertices[i].position_y, vertices[i].position_z);
+            normals[i] = glm::vec3(vertices[i].normal_x, vertices[i].normal_y, vertices[i].normal_z);
+        }
+
+        //weld vertices by position: sort, then the first of every run names the group
+        std::vector<unsigned int> order(vertex_count), group(vertex_count);
+        for (i = 0; i < vertex_count; i++) order[i] = i;
+        auto less = [&](unsigned int a, unsigned int b){
+            const glm::vec3 &p = positions[a], &q = positions[b];
+            return p.x != q.x ? p.x < q.x : (p.y != q.y ? p.y < q.y : p.z < q.z);
+        };
+        std::sort(order.begin(), order.end(), less);
+        //members of each group, as ranges of the sorted order
+        std::vector<unsigned int> member_begin(vertex_count, 0), member_end(vertex_count, 0);
+        for (i = 0; i < vertex_count; i++){
+            bool same = i > 0 && !less(order[i - 1], order[i]) && !less(order[i], order[i - 1]);
+            unsigned int g = same ? group[order[i - 1]] : order[i];
+            group[order[i]] = g;
+            if (!same) member_begin[g] = i;
+            member_end[g] = i + 1;
+        }
+
+        //plane quadrics of the triangles around every group, weighted by area
+        std::vector<_Quadric> quadrics(vertex_count, _Quadric());
+        std::vector<std::vector<unsigned int> > group_triangles(vertex_count);
+        std::vector<unsigned int> triangles(indices.begin(), indices.begin() + triangle_count * 3);
+        std::vector<bool> alive(triangle_count, true);
+        size_t alive_count = triangle_count;
+
+        for (i = 0; i < triangle_count; i++){
+            glm::vec3 a = positions[triangles[i * 3]], b = positions[triangles[i * 3 + 1]], c = positions[triangles[i * 3 + 2]];
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            float area = glm::length(normal);
+            if (area > 0) normal = normal / area;
+            for (k = 0; k < 3; k++){
+                unsigned int g = group[triangles[i * 3 + k]];
+                _addPlane(quadrics[g], normal, -glm::dot(normal, a), area);
+                group_triangles[g].push_back(i);
+            }
+        }
+
+        //open borders get a plane standing on them, so they don't shrink
+        std::vector<std::pair<unsigned long long, unsigned int> > edges;
+        for (i = 0; i < triangle_count; i++){
+            for (k = 0; k < 3; k++){
+                unsigned int u = group[triangles[i * 3 + k]], v = group[triangles[i * 3 + (k + 1) % 3]];
+                edges.push_back(std::make_pair(((unsigned long long)std::min(u, v) << 32) | std::max(u, v), i * 3 + k));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        for (size_t e = 0; e < edges.size(); e++){
+            bool shared = (e > 0 && edges[e - 1].first == edges[e].first) || (e + 1 < edges.size() && edges[e + 1].first == edges[e].first);
+            if (shared) continue;
+
+            unsigned int t = edges[e].second / 3, corner = edges[e].second % 3;
+            glm::vec3 a = positions[triangles[t * 3 + corner]], b = positions[triangles[t * 3 + (corner + 1) % 3]];
+            glm::vec3 c = positions[triangles[t * 3 + (corner + 2) % 3]];
+            glm::vec3 face = glm::cross(b - a, c - a);
+            glm::vec3 border = glm::cross(face, b - a);
+            float length = glm::length(border);
+            if (length == 0) continue;
+            border = border / length;
+            double weight = glm::dot(b - a, b - a) * 10.0;
+            _addPlane(quadrics[group[triangles[t * 3 + corner]]], border, -glm::dot(border, a), weight);
+            _addPlane(quadrics[group[triangles[t * 3 + (corner + 1) % 3]]], border, -glm::dot(border, a), weight);
+        }
+
+        //the copy in group to whose normal is closest to the vertex's
+        auto closest = [&](unsigned int vertex, unsigned int to){
+            unsigned int best = order[member_begin[to]];
+            float best_dot = -2;
+            for (unsigned int m = member_begin[to]; m < member_end[to]; m++){
+                float d = glm::dot(normals[vertex], normals[order[m]]);
+                if (d > best_dot){
+                    best_dot = d;
+                    best = order[m];
+                }
+            }
+            return best;
+        };
+        //moving group from onto to must not turn any remaining triangle around, or tilt it past about 75 degrees
+        auto flips = [&](unsigned int from, unsigned int to){
+            const std::vector<unsigned int> &around = group_triangles[from];
+            for (size_t t = 0; t < around.size(); t++){
+                unsigned int *corners = &triangles[around[t] * 3];
+                if (!alive[around[t]]) continue;
+                if (group[corners[0]] == to || group[corners[1]] == to || group[corners[2]] == to) continue;
+
+                glm::vec3 p[3], q[3];
+                for (k = 0; k < 3; k++){
+                    p[k] = positions[corners[k]];
+                    q[k] = group[corners[k]] == from ? positions[to] : p[k];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after)) return true;
+            }
+            return false;
+        };
+
+        //collapse the cheapest independent edges in passes, until the target is reached
+        std::vector<bool> locked(vertex_count);
+        std::vector<_Collapse> collapses;
+        while (alive_count * 3 > target_index_count){
+            collapses.clear();
+            for (i = 0; i < triangle_count; i++){
+                if (!alive[i]) continue;
+                for (k = 0; k < 3; k++){
+                    unsigned int u = group[triangles[i * 3 + k]], v = group[triangles[i * 3 + (k + 1) % 3]];
+                    if (u > v) continue;
+                    _Quadric q = quadrics[u];
+                    _addQuadric(q, quadrics[v]);
+                    double to_v = _quadricError(q, positions[v]), to_u = _quadricError(q, positions[u]);
+                    _Collapse collapse = { to_v <= to_u ? u : v, to_v <= to_u ? v : u, std::min(to_u, to_v) };
+                    collapses.push_back(collapse);
+                }
+            }
+            std::sort(collapses.begin(), collapses.end());
+            std::fill(locked.begin(), locked.end(), false);
+
+            size_t removed = 0, wanted = alive_count - target_index_count / 3;
+            for (size_t c = 0; c < collapses.size() && removed < wanted; c++){
+                unsigned int from = collapses[c].from, to = collapses[c].to;
+                if (locked[from] || locked[to] || flips(from, to)) continue;
+
+                std::vector<unsigned int> &around = group_triangles[from];
+                for (size_t t = 0; t < around.size(); t++){
+                    unsigned int *corners = &triangles[around[t] * 3];
+                    if (!alive[around[t]]) continue;
+
+                    //triangles on the edge disappear, the others follow the vertex
+                    if (group[corners[0]] == to || group[corners[1]] == to || group[corners[2]] == to){
+                        alive[around[t]] = false;
+                        alive_count--;
+                        removed++;
+                        continue;
+                    }
+                    for (k = 0; k < 3; k++){
+                        if (group[corners[k]] == from) corners[k] = closest(corners[k], to);
+                    }
+                    group_triangles[to].push_back(around[t]);
+                }
+                std::vector<unsigned int>().swap(around);
+                _addQuadric(quadrics[to], quadrics[from]);
+                locked[from] = locked[to] = true;
+            }
+
+            if (removed == 0) break;
+        }
+
+        result.clear();
+        result.reserve(alive_count * 3);
+        for (i = 0; i < triangle_count; i++){
+            if (!alive[i]) continue;
+            result.push_back(triangles[i * 3]);
+            result.push_back(triangles[i * 3 + 1]);
+            result.push_back(triangles[i * 3 + 2]);
+        }
+    }
+
+    void _buildLodChain(const std::vector<VertexFormat> &vertices, std::vector<unsigned int> &indices, MeshLodChain &lods){
+        std::vector<unsigned int> level = indices, coarser;
+
+        lods.count = 1;
+        lods.first_index[0] = 0;
+        lods.index_count[0] = (unsigned int)indices.size();
+
+        while (lods.count < MESH_LOD_COUNT){
+            size_t target = (size_t)(level.size() / 3 * MESH_LOD_RATIO) * 3;
+            if (target < MESH_LOD_MIN_TRIANGLES * 3) break;
+
+            _simplifyMesh(vertices, level, target, coarser);
+            //not worth a level if it barely simplified
+            if (coarser.size() > level.size() * (1 + MESH_LOD_RATIO) / 2) break;
+
+            _optimizeVertexCache(coarser, (unsigned int)vertices.size(), MESH_VERTEX_CACHE_SIZE);
+            lods.first_index[lods.count] = (unsigned int)indices.size();
+            lods.index_count[lods.count] = (unsigned int)coarser.size();
+            indices.insert(indices.end(), coarser.begin(), coarser.end());
+            lods.count++;
+            level.swap(coarser);
+        }
+    }
+}
@@ -0,0 +1,21 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Mesh simplification and level of detail chains. Edges are collapsed in order of their
+// quadric error (Garland, Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997), always
+// onto an existing vertex, so every level indexes the same vertex buffer.
+// ------------------------------------------------ -------------------------------------------------
+
+#pragma once
+
+#include "mesh_loader.h"
+
+namespace mesh{
+    // Simplify indexed triangles down to about target_index_count indices. Vertices sharing a position
+    // move together, and pick the copy with the closest normal on the other side, so hard edges and
+    // texture seams survive. Stops early when no collapse is left that wouldn't flip a triangle.
+    void _simplifyMesh(const std::vector<VertexFormat> &vertices, const std::vector<unsigned int> &indices,
+        size_t target_index_count, std::vector<unsigned int> &result);
+
+    // Append coarser levels to indices, each keeping MESH_LOD_RATIO of the previous one's triangles,
+    // until MESH_LOD_COUNT levels or MESH_LOD_MIN_TRIANGLES. Level 0 is the original indices.
+    void _buildLodChain(const std::vector<VertexFormat> &vertices, std::vector<unsigned int> &indices, MeshLodChain &lods);
+}
@@ -1,5 +1,19 @@
 #version 410 // -*- c++ -*-
 
+// Specialization, defined by ShaderPermutations when the program is built:
+// MOUNTAIN_COLORS   0 none (light proxies, flat terrain), 1 procedural, 2 baked
+// LIGHT_TYPE        0 omni, 1 spot
+// LIGHTS_ON         0 or 1
+#ifndef MOUNTAIN_COLORS
+#   define MOUNTAIN_COLORS 0
+#endif
+#ifndef LIGHT_TYPE
+#   define LIGHT_TYPE 0
+#endif
+#ifndef LIGHTS_ON
+#   define LIGHTS_ON 1
+#endif
+
 const float PI = 3.1415927;
 
 in Varying {
@@ -88,13 +102,20 @@ float snoise(vec2 v)
 // Noise function, applying multiple octaves with various frequencies and
 // amplitudes.
 
+// Number of octaves, lowered by the quality governor. Only the procedural
+// colors use it, the baked ones always have QUALITY_NOISE_OCTAVES.
+uniform int noise_octaves;
+
 float noise(vec2 position) {
     float noise = 0;
     float frequency, amplitude;
 
-    // Apply 3 octaves. The first one applies large spots, with high
+    // Apply the octaves. The first one applies large spots, with high
     // intensity. The following ones fill in smaller details.
-    for (int i = 0; i < 3; i++) {
+    // A zero frequency octave would be snoise(0) == 0 with an infinite
+    // amplitude, so counting starts at 1. Keep in sync with mountainNoise()
+    // in world.cpp, which bakes the same bands.
+    for (int i = 1; i <= noise_octaves; i++) {
         frequency = 0.01 * i;
         amplitude = 3.4 / i;
 
@@ -112,7 +133,6 @@ float noise(vec2 position) {
 const int max_lights = 50;
 
 uniform int light_count;
-uniform int light_type;
 uniform vec3 spotlight_direction;
 uniform vec3 light_positions[max_lights];
 uniform vec4 light_colors[max_lights];
@@ -131,8 +151,6 @@ uniform vec4 material_ka;
 uniform vec4 material_kd;
 uniform vec4 material_ks;
 
-uniform bool lights_on;
-
 uniform vec4 ambiental_light;
 uniform vec4 background_color;
 
@@ -149,54 +167,40 @@ float computeAttenuation(float distance, float light_size) {
 
 //============================================================================== LIGHT
 
-// Compute the light for a vertex, coming from a single light source.
+// Compute the light for a vertex, coming from a single light source. Only
+// compiled in when lights are on, and without any branch on the light type.
 vec4 computeLight(vec3 position, vec3 V, vec4 color, float inner_angle,
     float outer_angle, float light_size) {
 
-    // If lights are disabled, we no longer have to compute this.
-    if (lights_on) {
-        // Compute light direction.
-        vec3 L = position - interpolated.position;
-        vec3 Ln = normalize(L);
-        float spot_falloff = 1.0;
-
-        // Compute angle between spotlight direction and light direction.
-        float current_angle = dot(-Ln, spotlight_direction);
-
-        // If the light is spotlight, we also compute the falloff.
-        if (light_type == 1) {
-            float difference_angle = inner_angle - outer_angle;
-            spot_falloff = clamp((current_angle - outer_angle) /
-                difference_angle, 0.0, 1.0);
-        }
-
-        // If our vertex is inside the spotlight or the light is omni.
-        if ((light_type == 1 && current_angle > outer_angle) ||
-            light_type == 0) {
+    // Compute light direction.
+    vec3 L = position - interpolated.position;
+    vec3 Ln = normalize(L);
 
-            vec3 H = normalize(Ln + V);
+#if LIGHT_TYPE == 1
+    // Falloff from the angle between spotlight direction and light direction.
+    // It reaches 0 at the outer angle, so outside the cone nothing is added.
+    float current_angle = dot(-Ln, spotlight_direction);
+    float spot_falloff = clamp((current_angle - outer_angle) /
+        (inner_angle - outer_angle), 0.0, 1.0);
+#else
+    const float spot_falloff = 1.0;
+#endif
 
-            float dist = length(L);
-            // Compute attenuation.
-            float attenuation = computeAttenuation(dist, light_size);
+    vec3 H = normalize(Ln + V);
 
-            vec4 diffuseLight, specularLight;
+    // Compute attenuation.
+    float attenuation = computeAttenuation(length(L), light_size);
 
-            // Calculate the diffuse component.
-            diffuseLight = material_kd * color * max(dot(interpolated.normal, Ln), 0);
+    // Calculate the diffuse component.
+    vec4 diffuseLight = material_kd * color * max(dot(interpolated.normal, Ln), 0);
 
-            // Compute the specular component and return attenuated and reduced
-            // color (reduced only if spotlight).
-            if (diffuseLight.x > 0 || diffuseLight.y > 0 || diffuseLight.z > 0) {
-                specularLight = (material_ks * color *
-                    pow(max(dot(interpolated.normal, H), 0), material_shininess));
+    // The specular component only counts where the diffuse one is lit.
+    float lit = float(any(greaterThan(diffuseLight.xyz, vec3(0))));
+    vec4 specularLight = lit * (material_ks * color *
+        pow(max(dot(interpolated.normal, H), 0), material_shininess));
 
-                return spot_falloff * attenuation * (diffuseLight + specularLight);
-			}
-        }
-    }
-
-    return vec4(0, 0, 0, 0);
+    // Return attenuated and reduced color (reduced only if spotlight).
+    return spot_falloff * attenuation * (diffuseLight + specularLight);
 }
 
 //============================================================================== FOG
@@ -204,35 +208,43 @@ vec4 computeLight(vec3 position, vec3 V, vec4 color, float inner_angle,
 uniform vec4 fog_color;
 uniform float fog_start;
 uniform float fog_end;
-uniform bool fog_switch;
 
 // Compute the current fog value.
 float fog(float dist) {
-    if (fog_switch)
-        return clamp(1 - (dist - fog_start) / (fog_end - fog_start), 0, 1);
-    return 1;
+    return clamp(1 - (dist - fog_start) / (fog_end - fog_start), 0, 1);
 }
 
 //============================================================================== MOUNTAIN
 
-uniform bool draw_mountain;
 uniform vec4 color_top;
 uniform vec2 boundary_top;
 uniform vec4 color_bottom;
 uniform vec2 boundary_bottom;
 
+// Band weights baked per block by World::bakeColorBands (top, bottom).
+uniform sampler2D mountain_bands;
+uniform float block_length;
+
 // Compute current mountain color.
 vec4 computeMountainColor(vec3 position, vec4 original_color) {
+    float top_percentage, bottom_percentage;
+
+#if MOUNTAIN_COLORS == 2
+    vec2 bands = texture(mountain_bands, position.xz / block_length).rg;
+    top_percentage = bands.r;
+    bottom_percentage = bands.g;
+#else
     // Retrieve the current height and introduce the noise component.
     float height = position.y - noise(position.xz);
 
     // Calculate the percentage for the top color.
-    float top_percentage = clamp(1 - (height - boundary_top.x) /
+    top_percentage = clamp(1 - (height - boundary_top.x) /
         (boundary_top.y-boundary_top.x), 0, 1);
 
     // Calculate the percentage for the bottom color.
-    float bottom_percentage = clamp(1 - (height - boundary_bottom.x) /
+    bottom_percentage = clamp(1 - (height - boundary_bottom.x) /
         (boundary_bottom.y-boundary_bottom.x), 0, 1);
+#endif
 
     // Mix colors.
     vec4 color = mix(original_color, color_bottom, bottom_percentage);
@@ -262,19 +274,21 @@ void main(){
             //color += computeLight(sun_position, V, sun_color, 0, 0, sun_size);
 
             // If we're drawing mountains, combine the color.
-            if (draw_mountain) {
-                color = computeMountainColor(interpolated.position, color);
-            }
+#if MOUNTAIN_COLORS != 0
+            color = computeMountainColor(interpolated.position, color);
+#endif
 
             // Compute the color, considering every other light in the scene.
+#if LIGHTS_ON
             for (i = 0; i < light_count; i++) {
                 color += computeLight(light_positions[i], V, light_colors[i],
                     light_inner_angles[i], light_outer_angles[i],
                     light_sizes[i]);
             }
+#endif
 
             // If we're drawing fog and the vertex is inside fog falloff.
-            /*if (fog_switch && dist >= fog_start) {
+            /*if (dist >= fog_start) {
                 // Compute fog value and mix fog values. The fog color is also
                 // mixed with background color, to achieve a transition between
                 // the sky and the fog.
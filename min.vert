@@ -1,10 +1,15 @@
 #version 410 // -*- c++ -*-
 
-// Attributes
+// Attributes, packed: the position as unorms inside the mesh bounds, the
+// normal octahedral encoded.
 layout(location=6) in vec3 position;
-layout(location=7) in vec3 normal;
+layout(location=7) in vec2 normal;
 layout(location=8) in vec2 texCoord;
 
+// Mesh bounds, decoding the packed position.
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
 // Interpolated outputs
 out Varying {
     vec3        normal;
@@ -20,10 +25,23 @@ uniform Uniform {
     vec3        cameraPosition;
 } object;
 
+// Must stay bit-identical to depth.vert for the GL_EQUAL color pass.
+invariant gl_Position;
+
+// Unfold the octahedron back to a unit vector.
+vec3 decodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
 void main () {
+    vec3 objectPosition = position_offset + position_scale * position;
+
     vertexOutput.texCoord   = texCoord;
-    vertexOutput.normal     = normalize(mat3(object.objectToWorldMatrix) * normal);
-	vertexOutput.position   = position;
+    vertexOutput.normal     = normalize(mat3(object.objectToWorldMatrix) * decodeOctahedral(normal));
+	vertexOutput.position   = objectPosition;
 
-    gl_Position = object.modelViewProjectionMatrix * vec4(position, 1.0);
+    gl_Position = object.modelViewProjectionMatrix * vec4(objectPosition, 1.0);
 }
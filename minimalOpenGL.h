@@ -24,6 +24,8 @@
 #   include <GL/xglew.h>
 #endif
 #include <glfw3.h> 
+#include "gl_state.h"
+#include "texture_loader.h"
 
 
 #ifdef _WINDOWS
@@ -44,6 +46,7 @@
 #include <cmath>
 #include <cassert>
 #include <vector>
+#include <algorithm>
 
 
 void APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam) {
@@ -53,7 +56,16 @@ void APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severi
 }
 
 
-GLFWwindow* initOpenGL(int width, int height, const std::string& title) {
+/* Creates the window and its context. An offscreen context is a hidden window, preferring
+   EGL then OSMesa so it also runs without a display (llvmpipe on CI machines), where the
+   GLFW version supports choosing them.*/
+GLFWwindow* initOpenGL(int width, int height, const std::string& title, bool offscreen = false) {
+#   if defined(_LINUX) && defined(GLFW_PLATFORM_NULL)
+        if (offscreen && ! getenv("DISPLAY") && ! getenv("WAYLAND_DISPLAY")) {
+            glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+        }
+#   endif
+
     if (! glfwInit()) {
         fprintf(stderr, "ERROR: could not start GLFW\n");
         ::exit(1);
@@ -70,7 +82,28 @@ GLFWwindow* initOpenGL(int width, int height, const std::string& title) {
        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
 #   endif
 
-    GLFWwindow* window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
+    GLFWwindow* window = nullptr;
+    if (offscreen) {
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+
+#       ifdef GLFW_CONTEXT_CREATION_API
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+            window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
+#           ifdef GLFW_OSMESA_CONTEXT_API
+                if (! window) {
+                    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+                    window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
+                }
+#           endif
+            if (! window) {
+                glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_NATIVE_CONTEXT_API);
+            }
+#       endif
+    }
+
+    if (! window) {
+        window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
+    }
     if (! window) {
         fprintf(stderr, "ERROR: could not open window with GLFW\n");
         glfwTerminate();
@@ -153,23 +186,50 @@ GLuint createShaderProgram(const std::string& vertexShaderSource, const std::str
 }
 
 
-/* Submits a full-screen quad at the far plane and runs a procedural sky shader on it.*/
-void drawSky(int windowWidth, int windowHeight, const float* cameraToWorldMatrix, const float* projectionMatrixInverse) {
-#   define VERTEX_SHADER(s) "#version 410\n" #s
-#   define PIXEL_SHADER(s) VERTEX_SHADER(s)
+// The procedural sky is cached in a low resolution cubemap, refreshed a few
+// faces per frame once the camera has moved far enough for the clouds to shift.
+#define SKY_CUBEMAP_SIZE 256
+#define SKY_FACES_PER_FRAME 2
+#define SKY_REFRESH_DISTANCE 500.0f
+#define SKY_TEXTURE_UNIT 2
+
+static GLuint skyBakeShader = GL_NONE;
+static GLuint skyShader = GL_NONE;
+static GLuint skyCubemap = GL_NONE;
+static GLuint skyFramebuffer = GL_NONE;
+
+/* Face direction for cubemap texel coordinates s, t in [-1, 1]: faceMatrix * (s, t, 1), column-major.*/
+static const float skyFaceMatrix[6][9] = {
+    {  0, 0, -1,   0, -1,  0,   1,  0,  0 }, // +X
+    {  0, 0,  1,   0, -1,  0,  -1,  0,  0 }, // -X
+    {  1, 0,  0,   0,  0,  1,   0,  1,  0 }, // +Y
+    {  1, 0,  0,   0,  0, -1,   0, -1,  0 }, // -Y
+    {  1, 0,  0,   0, -1,  0,   0,  0,  1 }, // +Z
+    { -1, 0,  0,   0, -1,  0,   0,  0, -1 }  // -Z
+};
+
 
-    static const GLuint skyShader = createShaderProgram(VERTEX_SHADER
+#define VERTEX_SHADER(s) "#version 410\n" #s
+#define PIXEL_SHADER(s) VERTEX_SHADER(s)
+
+/* Full-screen triangle vertex shader, shared by both sky passes.*/
+const std::string& skyVertexSource() {
+    static const std::string source = VERTEX_SHADER
     (void main() {
         gl_Position = vec4(gl_VertexID & 1, gl_VertexID >> 1, 0.0, 0.5) * 4.0 - 1.0;
-    }),
+    });
+    return source;
+}
 
-    PIXEL_SHADER
+/* Procedural sky, rendered into one cubemap face at a time.*/
+const std::string& skyBakeSource() {
+    static const std::string source = PIXEL_SHADER
     (out vec3 pixelColor;
 
     //uniform vec3  light; //sunlight
-    uniform vec2  resolution;
-    uniform mat4  cameraToWorldMatrix;
-    uniform mat4  invProjectionMatrix;
+    uniform float size;
+    uniform mat3  faceMatrix;
+    uniform vec3  origin;
 
     float hash(vec2 p) { return fract(1e4 * sin(17.0 * p.x + p.y * 0.1) * (0.1 + abs(sin(p.y * 13.0 + p.x)))); }
 
@@ -196,7 +256,7 @@ void drawSky(int windowWidth, int windowHeight, const float* cameraToWorldMatrix
     }
 
 	// Sky
-    vec3 render(in vec3 ro, in vec3 rd, in float resolution) {
+    vec3 render(in vec3 ro, in vec3 rd) {
         vec3 col;
         
         col = vec3(0.2, 0.2, 0.2) * (1.0 - 0.8 * rd.y) * 0.9;
@@ -209,20 +269,127 @@ void drawSky(int windowWidth, int windowHeight, const float* cameraToWorldMatrix
         return mix(col, vec3(0.0, 0.0, 0.0), pow(1.0 - max(abs(rd.y), 0.0), 8.0));
     }
 
+    void main() {
+        vec3 rd = normalize(faceMatrix * vec3(gl_FragCoord.xy / size * 2.0 - 1.0, 1.0));
+        pixelColor = render(origin, rd);
+    });
+    return source;
+}
+
+/* Looks up the cached sky cubemap for each pixel.*/
+const std::string& skySource() {
+    static const std::string source = PIXEL_SHADER
+    (out vec3 pixelColor;
+
+    uniform vec2        resolution;
+    uniform mat4        cameraToWorldMatrix;
+    uniform mat4        invProjectionMatrix;
+    uniform samplerCube skyCubemap;
+
     void main() {
         vec3 rd = normalize(mat3(cameraToWorldMatrix) * vec3((invProjectionMatrix * vec4(gl_FragCoord.xy / resolution.xy * 2.0 - 1.0, -1.0, 1.0)).xy, -1.0));
-        pixelColor = render(cameraToWorldMatrix[3].xyz, rd, resolution.x);
-    }));
+        pixelColor = texture(skyCubemap, rd).rgb;
+    });
+    return source;
+}
+
+#undef PIXEL_SHADER
+#undef VERTEX_SHADER
+
+
+/* Takes the programs built from skyBakeSource and skySource and allocates the sky cubemap.
+   Call once after initOpenGL.*/
+void initSky(GLuint bakeProgram, GLuint program) {
+    skyBakeShader = bakeProgram;
+    skyShader = program;
+
+    glGenTextures(1, &skyCubemap);
+    GLState::bindTexture(SKY_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, skyCubemap);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    for (int face = 0; face < 6; ++face) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_R11F_G11F_B10F, SKY_CUBEMAP_SIZE, SKY_CUBEMAP_SIZE, 0, GL_RGB, GL_FLOAT, nullptr);
+    }
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    glGenFramebuffers(1, &skyFramebuffer);
+
+    GLState::useProgram(skyShader);
+    glUniform1i(glGetUniformLocation(skyShader, "skyCubemap"), SKY_TEXTURE_UNIT);
+
+    assert(glGetError() == GL_NONE);
+}
+
+
+/* Re-renders stale faces of the sky cubemap. Takes the same matrix as drawSky and leaves
+   the sky framebuffer bound, so call it before binding the eye framebuffer.*/
+void updateSky(const float* cameraToWorldMatrix) {
+    static bool initialized = false;
+    static int pendingFaces = 0;
+    static int nextFace = 0;
+    static float origin[3];
 
+    // Translation, as the sky shader reads cameraToWorldMatrix[3]
+#ifdef _VR
+    const float position[3] = { cameraToWorldMatrix[3], cameraToWorldMatrix[7], cameraToWorldMatrix[11] };
+#else
+    const float position[3] = { cameraToWorldMatrix[12], cameraToWorldMatrix[13], cameraToWorldMatrix[14] };
+#endif
+
+    if (pendingFaces == 0) {
+        const float dx = position[0] - origin[0], dy = position[1] - origin[1], dz = position[2] - origin[2];
+        if (initialized && (dx * dx + dy * dy + dz * dz < SKY_REFRESH_DISTANCE * SKY_REFRESH_DISTANCE)) {
+            return;
+        }
+
+        memcpy(origin, position, sizeof(origin));
+        pendingFaces = 6;
+    }
+
+    static const GLint sizeUniform   = glGetUniformLocation(skyBakeShader, "size");
+    static const GLint faceUniform   = glGetUniformLocation(skyBakeShader, "faceMatrix");
+    static const GLint originUniform = glGetUniformLocation(skyBakeShader, "origin");
+
+    // The sky framebuffer has no depth attachment. The depth mask is left alone,
+    // as the eye framebuffer is cleared right after this.
+    GLStateScope scope(GL_STATE_SCOPE_SKY);
+    GLState::enable(GL_DEPTH_TEST, false);
+    GLState::enable(GL_CULL_FACE, false);
+
+    GLState::bindFramebuffer(GL_FRAMEBUFFER, skyFramebuffer);
+    GLState::viewport(0, 0, SKY_CUBEMAP_SIZE, SKY_CUBEMAP_SIZE);
+
+    GLState::useProgram(skyBakeShader);
+    glUniform1f(sizeUniform, float(SKY_CUBEMAP_SIZE));
+    glUniform3fv(originUniform, 1, origin);
+
+    // The first fill has nothing to show yet, so it renders every face at once
+    const int faceCount = initialized ? std::min(pendingFaces, SKY_FACES_PER_FRAME) : pendingFaces;
+    for (int i = 0; i < faceCount; ++i, --pendingFaces, nextFace = (nextFace + 1) % 6) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + nextFace, skyCubemap, 0);
+        glUniformMatrix3fv(faceUniform, 1, GL_FALSE, skyFaceMatrix[nextFace]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    initialized = true;
+}
+
+
+/* Submits a full-screen triangle at the far plane that looks up the cached sky cubemap.*/
+void drawSky(int windowWidth, int windowHeight, const float* cameraToWorldMatrix, const float* projectionMatrixInverse) {
     static const GLint resolutionUniform                 = glGetUniformLocation(skyShader, "resolution");
     static const GLint cameraToWorldMatrixUniform        = glGetUniformLocation(skyShader, "cameraToWorldMatrix");
     static const GLint invProjectionMatrixUniform        = glGetUniformLocation(skyShader, "invProjectionMatrix");
 
-    glDisable(GL_DEPTH_TEST);
-    glDepthMask(GL_FALSE);
-    glDisable(GL_CULL_FACE);
+    GLStateScope scope(GL_STATE_SCOPE_SKY);
+    GLState::enable(GL_DEPTH_TEST, false);
+    GLState::depthMask(GL_FALSE);
+    GLState::enable(GL_CULL_FACE, false);
 
-    glUseProgram(skyShader);
+    GLState::useProgram(skyShader);
     glUniform2f(resolutionUniform, float(windowWidth), float(windowHeight));
 
 #ifdef _VR
@@ -233,72 +400,13 @@ void drawSky(int windowWidth, int windowHeight, const float* cameraToWorldMatrix
 	glUniformMatrix4fv(invProjectionMatrixUniform, 1, GL_FALSE, projectionMatrixInverse);
 #endif
 
-    glDrawArrays(GL_TRIANGLES, 0, 3);
+    // Samplers bound to other units would override the cubemap filtering
+    GLState::bindTexture(SKY_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, skyCubemap);
+    GLState::bindSampler(SKY_TEXTURE_UNIT, GL_NONE);
 
-#   undef PIXEL_SHADER
-#   undef VERTEX_SHADER
+    glDrawArrays(GL_TRIANGLES, 0, 3);
 }
 
 
-/** Loads a 24- or 32-bit BMP file into memory */
-void loadBMP(const std::string& filename, int& width, int& height, int& channels, std::vector<std::uint8_t>& data) {
-    std::fstream hFile(filename.c_str(), std::ios::in | std::ios::binary);
-    if (! hFile.is_open()) { throw std::invalid_argument("Error: File Not Found."); }
-
-    hFile.seekg(0, std::ios::end);
-    size_t len = hFile.tellg();
-    hFile.seekg(0, std::ios::beg);
-    std::vector<std::uint8_t> header(len);
-    hFile.read(reinterpret_cast<char*>(header.data()), 54);
-
-    if ((header[0] != 'B') && (header[1] != 'M')) {
-        hFile.close();
-        throw std::invalid_argument("Error: File is not a BMP.");
-    }
-
-    if ((header[28] != 24) && (header[28] != 32)) {
-        hFile.close();
-        throw std::invalid_argument("Error: File is not uncompressed 24 or 32 bits per pixel.");
-    }
-
-    const short bitsPerPixel = header[28];
-    channels = bitsPerPixel / 8;
-    width  = header[18] + (header[19] << 8);
-    height = header[22] + (header[23] << 8);
-    std::uint32_t offset = header[10] + (header[11] << 8);
-    std::uint32_t size = ((width * bitsPerPixel + 31) / 32) * 4 * height;
-    data.resize(size);
-
-    hFile.seekg(offset, std::ios::beg);
-    hFile.read(reinterpret_cast<char*>(data.data()), size);
-    hFile.close();
-
-    // Flip the y axis
-    std::vector<std::uint8_t> tmp;
-    const size_t rowBytes = width * channels;
-    tmp.resize(rowBytes);
-    for (int i = height / 2 - 1; i >= 0; --i) {
-        const int j = height - 1 - i;
-        // Swap the rows
-        memcpy(tmp.data(), &data[i * rowBytes], rowBytes);
-        memcpy(&data[i * rowBytes], &data[j * rowBytes], rowBytes);
-        memcpy(&data[j * rowBytes], tmp.data(), rowBytes);
-    }
-
-    // Convert BGR[A] format to RGB[A] format
-    if (channels == 4) {
-        // BGRA
-        std::uint32_t* p = reinterpret_cast<std::uint32_t*>(data.data());
-        for (int i = width * height - 1; i >= 0; --i) {
-            const unsigned int x = p[i];
-            p[i] = ((x >> 24) & 0xFF) | (((x >> 16) & 0xFF) << 8) | (((x >> 8) & 0xFF) << 16) | ((x & 0xFF) << 24);
-        }
-    } else {
-        // BGR
-        for (int i = (width * height - 1) * 3; i >= 0; i -= 3) {
-            std::swap(data[i], data[i + 2]);
-        }
-    }
-}
 
 #pragma clang diagnostic pop
@@ -0,0 +1,81 @@
+/**
+* Description: Content quality governor. Steps the terrain level of detail,
+* the active light count and the shader noise octaves up and down, with
+* hysteresis, to keep the measured frame times inside a budget.
+*/
+
+#include <stdio.h>
+#include "quality_governor.h"
+
+// Start at the best quality.
+QualityGovernor::QualityGovernor(float budget) {
+    this->budget = budget;
+    this->level = 0;
+    this->frames_over = 0;
+    this->frames_under = 0;
+    this->enabled = true;
+}
+
+QualityGovernor::~QualityGovernor() {}
+
+// The slower of CPU and GPU bounds the frame. Count how long it has stayed
+// over or well under the budget, and step one level when a count runs out.
+bool QualityGovernor::update(float cpu_time, float gpu_time) {
+    float frame_time = cpu_time > gpu_time ? cpu_time : gpu_time;
+
+    if (!this->enabled) return false;
+
+    if (frame_time > this->budget) {
+        this->frames_over++;
+        this->frames_under = 0;
+    }
+    else if (frame_time < this->budget * QUALITY_HEADROOM) {
+        this->frames_under++;
+        this->frames_over = 0;
+    }
+    else {
+        this->frames_over = 0;
+        this->frames_under = 0;
+    }
+
+    if (this->frames_over >= QUALITY_DOWN_FRAMES &&
+        this->level + 1 < QUALITY_LEVEL_COUNT) {
+        this->setLevel(this->level + 1);
+        return true;
+    }
+
+    if (this->frames_under >= QUALITY_UP_FRAMES && this->level > 0) {
+        this->setLevel(this->level - 1);
+        return true;
+    }
+
+    return false;
+}
+
+// Turn the governor on and off. It keeps the current level when turned off.
+void QualityGovernor::switchEnabled() {
+    this->enabled = !this->enabled;
+    this->frames_over = 0;
+    this->frames_under = 0;
+
+    printf("Quality governor: %s\n", this->enabled ? "on" : "off");
+}
+
+// Jump to a level and restart the hysteresis counters.
+void QualityGovernor::setLevel(unsigned int level) {
+    if (level >= QUALITY_LEVEL_COUNT) level = QUALITY_LEVEL_COUNT - 1;
+
+    this->level = level;
+    this->frames_over = 0;
+    this->frames_under = 0;
+
+    const QualityLevel& quality = QUALITY_LEVELS[level];
+    printf("Quality level %u: terrain lod %u, %d lights, %d noise octaves\n",
+        level, quality.terrain_level, quality.light_limit,
+        quality.noise_octaves);
+}
+
+unsigned int QualityGovernor::getLevel() { return this->level; }
+const QualityLevel& QualityGovernor::getQuality() {
+    return QUALITY_LEVELS[this->level];
+}
@@ -0,0 +1,67 @@
+/**
+* Description: Content quality governor. Steps the terrain level of detail,
+* the active light count and the shader noise octaves up and down, with
+* hysteresis, to keep the measured frame times inside a budget.
+*/
+
+#pragma once
+
+// Frame time budget, in seconds (90 Hz HMD refresh).
+#define QUALITY_FRAME_BUDGET (1.0f / 90.0f)
+
+// Consecutive frames over budget before stepping quality down.
+#define QUALITY_DOWN_FRAMES 15
+
+// Consecutive frames under QUALITY_HEADROOM of the budget before stepping
+// quality back up. Much longer than the way down, so a recovered frame rate
+// is not immediately spent again.
+#define QUALITY_UP_FRAMES 180
+#define QUALITY_HEADROOM 0.75f
+
+// Noise octaves of the procedural mountain colors at the best quality. The
+// baked colors, the default, are generated with as many and ignore the
+// per level count.
+#define QUALITY_NOISE_OCTAVES 2
+
+// A quality level, the value of every knob the governor controls.
+struct QualityLevel {
+    unsigned int terrain_level;
+    int light_limit;
+    int noise_octaves;
+};
+
+// Quality levels, from the best to the cheapest. Every step lowers the
+// terrain detail or the light count, so each one also pays off with baked
+// colors, where the octaves make no difference.
+const QualityLevel QUALITY_LEVELS[] = {
+    { 0, 50, QUALITY_NOISE_OCTAVES },
+    { 0, 32, 2 },
+    { 1, 32, 1 },
+    { 1, 16, 1 },
+    { 2, 16, 0 },
+    { 2, 8, 0 }
+};
+
+#define QUALITY_LEVEL_COUNT (sizeof(QUALITY_LEVELS) / sizeof(QUALITY_LEVELS[0]))
+
+class QualityGovernor {
+public:
+    QualityGovernor(float budget);
+    ~QualityGovernor();
+
+    // Feed the measured CPU and GPU frame times (seconds). Returns true when
+    // the quality level changed and the knobs must be applied again.
+    bool update(float cpu_time, float gpu_time);
+    void switchEnabled();
+
+    void setLevel(unsigned int level);
+    unsigned int getLevel();
+    const QualityLevel& getQuality();
+
+private:
+    float budget;
+    unsigned int level;
+    int frames_over;
+    int frames_under;
+    bool enabled;
+};
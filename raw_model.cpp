@@ -12,16 +12,23 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "raw_model.h"
+#include "mesh_meshlet.h"
+#include "gl_state.h"
 
-// Load the object at the respective path.
-_RawModel::_RawModel(const RawModelInfo* info) {
-    this->info = info;
-    mesh::loadObj(info->path, this->vao, this->vbo, this->ibo, this->index_count);
+// Upload a mesh read by the asset manager, size being its size in RAW_MODELS.
+_RawModel::_RawModel(glm::vec3 size, const mesh::MeshData& mesh) {
+    this->size = size;
+    mesh::uploadMesh(mesh, this->vao, this->vbo, this->ibo, this->index_count);
+    this->position_offset = mesh.position_offset;
+    this->position_scale = mesh.position_scale;
+    this->lods = mesh.lods;
+    this->meshlets = mesh.meshlets;
 }
 
 // Free the memory used by the buffers
 _RawModel::~_RawModel() {
-    glDeleteBuffers(1, &(this->vao));
+    GLState::forgetVertexArray(this->vao);
+    glDeleteVertexArrays(1, &(this->vao));
     glDeleteBuffers(1, &(this->vbo));
     glDeleteBuffers(1, &(this->ibo));
 }
@@ -31,31 +38,124 @@ void _RawModel::render(RawModelMaterial* material,
     glm::vec3 position, glm::vec3 size,
     glm::mat4 model_matrix, glm::mat4 transform_matrix,
     unsigned int shader, glm::mat4* objectToWorldMatrix,  glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]) {
+    // Bounds the packed positions are relative to.
+    glUniform3f(glGetUniformLocation(shader, "position_offset"),
+        this->position_offset.x, this->position_offset.y, this->position_offset.z);
+    glUniform3f(glGetUniformLocation(shader, "position_scale"),
+        this->position_scale.x, this->position_scale.y, this->position_scale.z);
+
+    // Placed the way RawModelFactory::render places the model.
+    glm::mat4 object_to_world = model_matrix *
+        glm::translate(model_matrix, position) * transform_matrix;
+
+    // Pick the level of detail for the size on screen.
+    unsigned int lod = this->selectLod(object_to_world, projectionMatrix,
+        cameraToWorldMatrix);
+
+    // At full detail, large meshes only draw the meshlets facing the eye
+    // inside the frustum. Culling happens in object space.
+    const RawModelRanges* ranges = NULL;
+    if (lod == 0 && !this->meshlets.empty()) {
+        glm::mat4 object_to_clip = *projectionMatrix *
+            glm::inverse(*cameraToWorldMatrix) * object_to_world;
+        glm::vec3 camera = glm::vec3(glm::inverse(object_to_world) *
+            (*cameraToWorldMatrix)[3]);
+
+        this->visible.counts.clear();
+        this->visible.offsets.clear();
+        mesh::cullMeshlets(this->meshlets, object_to_clip, camera,
+            this->visible.counts, this->visible.offsets);
+        ranges = &this->visible;
+    }
+
     // Delegate to the generic render function.
-    RawModelFactory::render(this->vao, this->index_count,
+    RawModelFactory::render(this->vao, this->lods.index_count[lod],
         material, position,
-        glm::vec3(size.x / this->info->size.x, size.y / this->info->size.y,
-        size.z / this->info->size.z),
-        model_matrix, transform_matrix, shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
+        glm::vec3(size.x / this->size.x, size.y / this->size.y,
+        size.z / this->size.z),
+        model_matrix, transform_matrix, shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset,
+        this->lods.first_index[lod], ranges);
+}
+
+// Level of detail for the model's bounding sphere. The coarsest level stays
+// in use for anything smaller.
+unsigned int _RawModel::selectLod(glm::mat4 object_to_world,
+    glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix) {
+    glm::vec3 center = glm::vec3(object_to_world * glm::vec4(
+        this->position_offset + this->position_scale * 0.5f, 1));
+    float scale = glm::max(glm::length(glm::vec3(object_to_world[0])),
+        glm::max(glm::length(glm::vec3(object_to_world[1])),
+        glm::length(glm::vec3(object_to_world[2]))));
+    float radius = glm::length(this->position_scale) * 0.5f * scale;
+    float distance = glm::length(center - glm::vec3((*cameraToWorldMatrix)[3]));
+
+    // Inside the sphere always gets the full mesh.
+    if (distance <= radius) return 0;
+
+    float screen_size = radius * (*projectionMatrix)[1][1] / distance;
+    float threshold = RAW_MODEL_LOD_SCREEN_SIZE;
+    unsigned int lod = 0;
+
+    while (lod + 1 < this->lods.count && screen_size < threshold) {
+        lod++;
+        threshold *= 0.5f;
+    }
+
+    return lod;
 }
 
-// Instantiate all models.
+// A box of the model's size around its origin, drawn until it is loaded.
+static _RawModel* createPlaceholder(glm::vec3 size) {
+    // Corner i is at +size/2 on the axes whose bit is set in i.
+    static const unsigned int box_indices[36] = {
+        0, 4, 6, 0, 6, 2, // -x
+        1, 3, 7, 1, 7, 5, // +x
+        0, 1, 5, 0, 5, 4, // -y
+        2, 6, 7, 2, 7, 3, // +y
+        0, 2, 3, 0, 3, 1, // -z
+        4, 5, 7, 4, 7, 6  // +z
+    };
+    std::vector<mesh::VertexFormat> vertices;
+    mesh::MeshData box;
+
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner = glm::vec3(i & 1 ? 0.5f : -0.5f,
+            i & 2 ? 0.5f : -0.5f, i & 4 ? 0.5f : -0.5f);
+        glm::vec3 normal = glm::normalize(corner);
+        corner = corner * size;
+        vertices.push_back(mesh::VertexFormat(corner.x, corner.y, corner.z,
+            normal.x, normal.y, normal.z, 0, 0));
+    }
+
+    mesh::_packVertices(vertices, box.vertices, box.position_offset,
+        box.position_scale);
+    box.indices.assign(box_indices, box_indices + 36);
+    box.lods.count = 1;
+    box.lods.first_index[0] = 0;
+    box.lods.index_count[0] = 36;
+
+    return new _RawModel(size, box);
+}
+
+// Request the predefined models.
 RawModelFactory::RawModelFactory() {
-    for (int i = 0; i < RAW_MODEL_COUNT; i++) {
-        RawModelFactory::models[i] = new _RawModel(&(RAW_MODELS[i]));
+    for (unsigned int i = 0; i < sizeof(RAW_MODELS) / sizeof(RAW_MODELS[0]); i++) {
+        RawModelFactory::addModel(RAW_MODELS[i]);
     }
 }
 
-// Destruct all models.
+// Release all models.
 RawModelFactory::~RawModelFactory() {
-    for (int i = 0; i < RAW_MODEL_COUNT; i++) {
-        RawModelFactory::models[i]->~_RawModel();
+    for (unsigned int i = 0; i < RawModelFactory::models.size(); i++) {
+        AssetManager::release(RawModelFactory::models[i].asset);
+        delete RawModelFactory::models[i].placeholder;
     }
+    RawModelFactory::models.clear();
 }
 
 // Initialize static variables.
 RawModelFactory* RawModelFactory::instance = 0;
-_RawModel* RawModelFactory::models[RAW_MODEL_COUNT];
+std::vector<RawModelFactory::Model> RawModelFactory::models;
 
 // Singleton instantiator.
 void RawModelFactory::instantiateModelFactory() {
@@ -65,21 +165,36 @@ void RawModelFactory::instantiateModelFactory() {
 }
 
 void RawModelFactory::destructModelFactory() {
-    if (RawModelFactory::instance == 0) {
-        RawModelFactory::instance->~RawModelFactory();
+    if (RawModelFactory::instance != 0) {
+        delete RawModelFactory::instance;
+        RawModelFactory::instance = 0;
     }
 }
 
+int RawModelFactory::addModel(const RawModelInfo& info) {
+    Model model;
+    model.asset = AssetManager::loadModel(info.path, info.size);
+    model.placeholder = createPlaceholder(info.size);
+    RawModelFactory::models.push_back(model);
+
+    return (int)RawModelFactory::models.size() - 1;
+}
+
 // Render a model based on the requested ID.
 void RawModelFactory::renderModel(int model_id, RawModelMaterial* material,
     glm::vec3 position, glm::vec3 size,
     glm::mat4 model_matrix, glm::mat4 transform_matrix,
     unsigned int shader, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]) {
+    GLStateScope scope(GL_STATE_SCOPE_MODELS);
+
     // Make sure the models are loaded first.
     RawModelFactory::instantiateModelFactory();
 
-    // Render the model.
-    RawModelFactory::models[model_id]->render(material, position, size,
+    // Render the model, or its box while it loads.
+    _RawModel* model = AssetManager::getModel(RawModelFactory::models[model_id].asset);
+    if (!model) model = RawModelFactory::models[model_id].placeholder;
+
+    model->render(material, position, size,
         model_matrix, transform_matrix, shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
 }
 
@@ -88,7 +203,8 @@ void RawModelFactory::render(unsigned int vao, unsigned int index_count,
 	RawModelMaterial* material,
 	glm::vec3 position, glm::vec3 size,
 	glm::mat4 model_matrix, glm::mat4 transform_matrix,
-	unsigned int shader, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]) {
+	unsigned int shader, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[],
+	unsigned int first_index, const RawModelRanges* ranges) {
     
 	glm::mat4 scale_matrix, translation_matrix;
 	glm::vec3 camPos = glm::vec3((*cameraToWorldMatrix)[3]);
@@ -132,7 +248,18 @@ void RawModelFactory::render(unsigned int vao, unsigned int index_count,
 
 	glUnmapBuffer(GL_UNIFORM_BUFFER);
 
-    // Bind VAO buffer and call draw the object.
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT,0);
+    // Bind VAO buffer and call draw the object, from first_index on, or
+    // only the given ranges.
+    GLState::bindVertexArray(vao);
+    if (ranges) {
+        if (!ranges->counts.empty()) {
+            glMultiDrawElements(GL_TRIANGLES, ranges->counts.data(),
+                GL_UNSIGNED_INT, ranges->offsets.data(),
+                (GLsizei)ranges->counts.size());
+        }
+    }
+    else {
+        glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT,
+            (void*)(first_index * sizeof(unsigned int)));
+    }
 }
\ No newline at end of file
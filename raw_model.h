@@ -2,17 +2,22 @@
 * Credit of original goes to Stamate Cosmin
 *
 * Description: Raw model factory. The factory is a singleton to ensure that
-* models are loaded a single time throughout the program.
+* models are loaded a single time throughout the program. Models load through
+* the asset manager, a box stands in for each until it is ready.
 */
 
 #pragma once
 #include "mesh_loader.h"
+#include "asset_manager.h"
 
-#define RAW_MODEL_SPHERE 0 // Model types.
+#define RAW_MODEL_SPHERE 0 // Predefined model ids, in RAW_MODELS.
 #define RAW_MODEL_CONE 1
 #define RAW_MODEL_PLANE 2
 
-#define RAW_MODEL_COUNT 3
+// Projected size (bounding sphere radius over the distance, scaled by the
+// projection) under which the first coarser level of detail is drawn. Every
+// further level takes over at half the size of the previous one.
+#define RAW_MODEL_LOD_SCREEN_SIZE 0.25f
 
 struct RawModelInfo {
     char* path;
@@ -32,25 +37,40 @@ struct RawModelMaterial {
         shininess(shininess), ke(ke), ka(ka), kd(kd), ks(ks) {}
 };
 
-const RawModelInfo RAW_MODELS[] = { // Model attributes.
+const RawModelInfo RAW_MODELS[] = { // Predefined models, requested first.
     { "resources\\sphere.obj", glm::vec3(10, 10, 10) } // Sphere
     , { "resources\\cone.obj", glm::vec3(5, 7, 5) } // Cone
     , { "resources\\plane.obj", glm::vec3(10, 10, 1) } // Plane
 };
 
+// Index ranges drawn with one glMultiDrawElements, as counts and byte
+// offsets into the index buffer.
+struct RawModelRanges {
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+};
+
 // The raw model class should not be used and contains various information
 // about the predefined models, after they have been loaded.
 class _RawModel {
 public:
-    _RawModel(const RawModelInfo* info);
+    _RawModel(glm::vec3 size, const mesh::MeshData& mesh);
     ~_RawModel();
     void render(RawModelMaterial* material, glm::vec3 position, glm::vec3 size,
         glm::mat4 model_matrix, glm::mat4 transform_matrix,
         unsigned int shader, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]);
 
 private:
-    const RawModelInfo* info;
+    glm::vec3 size;
     unsigned int vao, vbo, ibo, index_count;
+    glm::vec3 position_offset, position_scale;
+    mesh::MeshLodChain lods;
+    std::vector<mesh::Meshlet> meshlets;
+    // Meshlets left after culling, reused between draws.
+    RawModelRanges visible;
+
+    unsigned int selectLod(glm::mat4 object_to_world,
+        glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix);
 };
 
 class RawModelFactory {
@@ -61,17 +81,26 @@ private:
 public:
     static void instantiateModelFactory();
     static void destructModelFactory();
+    // Request another model and return its id for renderModel. Returns
+    // at once, the model loads in the background.
+    static int addModel(const RawModelInfo& info);
     static void render(unsigned int vao, unsigned int index_count,
         RawModelMaterial* material,
         glm::vec3 position, glm::vec3 size,
         glm::mat4 model_matrix, glm::mat4 transform_matrix,
-        unsigned int shader, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]);
+        unsigned int shader, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[],
+        unsigned int first_index = 0, const RawModelRanges* ranges = NULL);
     static void renderModel(int model_id, RawModelMaterial* material,
         glm::vec3 position, glm::vec3 size,
         glm::mat4 model_matrix, glm::mat4 transform_matrix,
         unsigned int shader, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]);
 
 private:
+    struct Model {
+        AssetHandle asset;
+        _RawModel* placeholder;
+    };
+
     static RawModelFactory* instance;
-    static _RawModel* models[RAW_MODEL_COUNT];
+    static std::vector<Model> models;
 };
\ No newline at end of file
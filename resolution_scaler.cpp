@@ -0,0 +1,71 @@
+/**
+* Description: Dynamic resolution controller. Picks the fraction of the eye
+* render targets to draw into, from the measured frame time, so the frame
+* rate holds and the resolution drops when the GPU is overloaded.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include "resolution_scaler.h"
+
+// Start at full resolution.
+ResolutionScaler::ResolutionScaler(float target_frame_time) {
+    this->target_frame_time = target_frame_time;
+    this->average_frame_time = target_frame_time;
+    this->scale = RESOLUTION_MAXIMUM_SCALE;
+    this->average_scale = RESOLUTION_MAXIMUM_SCALE;
+    this->enabled = true;
+}
+
+ResolutionScaler::~ResolutionScaler() {}
+
+// Pixel cost grows with the square of the scale, so the scale that meets the
+// target is the measured scale times the square root of the ratio between
+// the target and the measured time. The measured scale is averaged like the
+// time, so a change isn't applied again while the average still lags behind
+// it. Drops react right away, growth waits for headroom and is rate limited.
+float ResolutionScaler::update(float frame_time) {
+    this->average_frame_time += (frame_time - this->average_frame_time) *
+        RESOLUTION_SMOOTHING;
+    this->average_scale += (this->scale - this->average_scale) *
+        RESOLUTION_SMOOTHING;
+
+    if (!this->enabled) return this->scale;
+
+    float ratio = this->target_frame_time / this->average_frame_time;
+
+    if (this->average_frame_time > this->target_frame_time) {
+        this->scale = fminf(this->scale, this->average_scale *
+            fmaxf(sqrtf(ratio), RESOLUTION_MAXIMUM_DROP));
+    }
+    else if (this->average_frame_time <
+        this->target_frame_time * RESOLUTION_HEADROOM) {
+        this->scale = fmaxf(this->scale, this->average_scale *
+            fminf(sqrtf(ratio * RESOLUTION_HEADROOM), RESOLUTION_MAXIMUM_GROWTH));
+    }
+
+    this->scale = fminf(fmaxf(this->scale, RESOLUTION_MINIMUM_SCALE),
+        RESOLUTION_MAXIMUM_SCALE);
+
+    return this->scale;
+}
+
+// Turn the controller on and off. When off, render at full resolution.
+void ResolutionScaler::switchEnabled() {
+    this->enabled = !this->enabled;
+    if (!this->enabled) this->scale = RESOLUTION_MAXIMUM_SCALE;
+
+    printf("Dynamic resolution: %s\n", this->enabled ? "on" : "off");
+}
+
+float ResolutionScaler::getScale() { return this->scale; }
+float ResolutionScaler::getAverageFrameTime() {
+    return this->average_frame_time;
+}
+
+// Scaled viewport, never empty.
+void ResolutionScaler::getViewport(unsigned int width, unsigned int height,
+    unsigned int* viewport_width, unsigned int* viewport_height) {
+    *viewport_width = (unsigned int)fmaxf(1.0f, floorf(width * this->scale));
+    *viewport_height = (unsigned int)fmaxf(1.0f, floorf(height * this->scale));
+}
@@ -0,0 +1,51 @@
+/**
+* Description: Dynamic resolution controller. Picks the fraction of the eye
+* render targets to draw into, from the measured frame time, so the frame
+* rate holds and the resolution drops when the GPU is overloaded.
+*/
+
+#pragma once
+
+// Frame time the controller aims for, in seconds (90 Hz HMD refresh).
+#define RESOLUTION_TARGET_FRAME_TIME (1.0f / 90.0f)
+
+// Range of the per-axis resolution scale.
+#define RESOLUTION_MINIMUM_SCALE 0.5f
+#define RESOLUTION_MAXIMUM_SCALE 1.0f
+
+// The scale only grows back when the frame time is below this fraction of
+// the target, so it doesn't oscillate around the budget.
+#define RESOLUTION_HEADROOM 0.85f
+
+// Largest change of the scale from the one the average frame time was
+// measured at, when dropping and growing.
+#define RESOLUTION_MAXIMUM_DROP 0.9f
+#define RESOLUTION_MAXIMUM_GROWTH 1.02f
+
+// Weight of the newest sample in the frame time and scale moving averages.
+#define RESOLUTION_SMOOTHING 0.1f
+
+class ResolutionScaler {
+public:
+    ResolutionScaler(float target_frame_time);
+    ~ResolutionScaler();
+
+    // Feed the measured frame time (seconds), returns the new scale.
+    float update(float frame_time);
+    void switchEnabled();
+
+    float getScale();
+    float getAverageFrameTime();
+
+    // Size of the scaled viewport inside a width x height render target.
+    void getViewport(unsigned int width, unsigned int height,
+        unsigned int* viewport_width, unsigned int* viewport_height);
+
+private:
+    float target_frame_time;
+    float average_frame_time;
+    // Scale the frames in the average were drawn at, averaged the same way.
+    float average_scale;
+    float scale;
+    bool enabled;
+};
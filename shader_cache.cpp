@@ -0,0 +1,283 @@
+/**
+* Description: Shader program cache. Programs are registered up front, then
+* built together: linked binaries are reused from disk when the sources and
+* the driver match, the rest are compiled in parallel (KHR_parallel_shader_compile)
+* and saved for the next launch.
+*/
+
+#include "shader_cache.h"
+#include <glfw3.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <fstream>
+#include <thread>
+#include <sys/stat.h>
+#ifdef _WIN32
+#   include <direct.h>
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#   define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRY *MaxShaderCompilerThreadsProc)(GLuint count);
+
+// 64-bit FNV-1a, enough to tell program sources apart.
+static uint64_t hashString(uint64_t hash, const std::string& text) {
+    for (size_t i = 0; i < text.size(); i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Print the compile or link log of a shader or program.
+static void printLog(GLuint object, bool is_program) {
+    GLint size = 0;
+    if (is_program) glGetProgramiv(object, GL_INFO_LOG_LENGTH, &size);
+    else glGetShaderiv(object, GL_INFO_LOG_LENGTH, &size);
+    if (size <= 1) return;
+
+    std::vector<GLchar> log(size);
+    if (is_program) glGetProgramInfoLog(object, size, &size, &log[0]);
+    else glGetShaderInfoLog(object, size, &size, &log[0]);
+    fprintf(stderr, "%s\n", &log[0]);
+}
+
+// Binaries are only valid for the driver that produced them, so the driver
+// identification is part of every cache key. Parallel compilation is turned
+// on here, if the driver supports it.
+ShaderCache::ShaderCache(const std::string& directory) {
+    this->directory = directory;
+    this->driver = std::string((const char*)glGetString(GL_VENDOR)) + "|" +
+        (const char*)glGetString(GL_RENDERER) + "|" +
+        (const char*)glGetString(GL_VERSION);
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    this->binaries = formats > 0;
+
+    MaxShaderCompilerThreadsProc maxThreads = NULL;
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+        maxThreads = (MaxShaderCompilerThreadsProc)
+            glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    }
+    else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile")) {
+        maxThreads = (MaxShaderCompilerThreadsProc)
+            glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+    }
+    this->parallel = maxThreads != NULL;
+    if (this->parallel) {
+        // Let the driver pick the number of threads.
+        maxThreads(0xFFFFFFFF);
+    }
+
+    if (this->binaries) {
+#       ifdef _WIN32
+            _mkdir(directory.c_str());
+#       else
+            mkdir(directory.c_str(), 0755);
+#       endif
+    }
+}
+
+// Delete every program still owned by the cache.
+ShaderCache::~ShaderCache() {
+    for (size_t i = 0; i < this->entries.size(); i++) {
+        glDeleteProgram(this->entries[i].program);
+    }
+}
+
+int ShaderCache::add(const std::string& name, const std::string& vertex_source,
+    const std::string& fragment_source) {
+    Entry entry;
+    entry.name = name;
+    entry.vertex_source = vertex_source;
+    entry.fragment_source = fragment_source;
+    entry.program = GL_NONE;
+    entry.stages[0] = entry.stages[1] = GL_NONE;
+
+    this->entries.push_back(entry);
+    return (int)this->entries.size() - 1;
+}
+
+// Cached programs are restored first. Everything else is submitted to the
+// compiler before any status is queried, so the driver can work on all of
+// them at the same time.
+void ShaderCache::build() {
+    std::vector<Entry*> compiling;
+
+    for (size_t i = 0; i < this->entries.size(); i++) {
+        Entry& entry = this->entries[i];
+        if (entry.program != GL_NONE || this->loadBinary(entry)) continue;
+
+        this->startCompile(entry);
+        compiling.push_back(&entry);
+    }
+
+    this->waitForCompletion(compiling);
+
+    for (size_t i = 0; i < compiling.size(); i++) {
+        if (!this->finishCompile(*compiling[i])) {
+            fprintf(stderr, "Error while building shader %s\n",
+                compiling[i]->name.c_str());
+            assert(false);
+        }
+    }
+}
+
+// Build the new program on the side and only swap it in once it linked,
+// so a typo while editing a shader doesn't take the renderer down.
+bool ShaderCache::reload(int id, const std::string& vertex_source,
+    const std::string& fragment_source) {
+    Entry& entry = this->entries[id];
+    Entry candidate = entry;
+    candidate.vertex_source = vertex_source;
+    candidate.fragment_source = fragment_source;
+    candidate.program = GL_NONE;
+
+    if (!this->loadBinary(candidate)) {
+        std::vector<Entry*> compiling(1, &candidate);
+        this->startCompile(candidate);
+        this->waitForCompletion(compiling);
+
+        if (!this->finishCompile(candidate)) {
+            fprintf(stderr, "Shader %s failed to build, keeping the old one\n",
+                entry.name.c_str());
+            return false;
+        }
+    }
+
+    glDeleteProgram(entry.program);
+    entry = candidate;
+    return true;
+}
+
+GLuint ShaderCache::getProgram(int id) { return this->entries[id].program; }
+
+// The key covers the driver and both sources.
+std::string ShaderCache::getBinaryPath(const Entry& entry) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashString(hash, this->driver);
+    hash = hashString(hash, std::string(1, '\0') + entry.vertex_source);
+    hash = hashString(hash, std::string(1, '\0') + entry.fragment_source);
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+    return this->directory + "/" + entry.name + "-" + key + ".bin";
+}
+
+// A cache file is the binary format followed by the program binary. A binary
+// the driver refuses (after an update, for example) is simply recompiled.
+bool ShaderCache::loadBinary(Entry& entry) {
+    if (!this->binaries) return false;
+
+    std::ifstream file(this->getBinaryPath(entry).c_str(),
+        std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.good()) return false;
+
+    std::streamoff size = (std::streamoff)file.tellg() - (std::streamoff)sizeof(GLenum);
+    if (size <= 0) return false;
+
+    GLenum format;
+    std::vector<char> binary((size_t)size);
+    file.seekg(0, std::ios::beg);
+    file.read((char*)&format, sizeof(format));
+    file.read(&binary[0], size);
+    if (!file.good()) return false;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, &binary[0], (GLsizei)size);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked == GL_FALSE) {
+        glDeleteProgram(program);
+        return false;
+    }
+
+    entry.program = program;
+    return true;
+}
+
+void ShaderCache::saveBinary(const Entry& entry) {
+    if (!this->binaries) return;
+
+    GLint size = 0;
+    glGetProgramiv(entry.program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) return;
+
+    GLenum format;
+    std::vector<char> binary(size);
+    glGetProgramBinary(entry.program, size, &size, &format, &binary[0]);
+
+    std::ofstream file(this->getBinaryPath(entry).c_str(),
+        std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write((const char*)&format, sizeof(format));
+    file.write(&binary[0], size);
+}
+
+// Submit both stages and the link without waiting for any of them.
+void ShaderCache::startCompile(Entry& entry) {
+    const GLenum stage_types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    const std::string* sources[2] = { &entry.vertex_source,
+        &entry.fragment_source };
+
+    entry.program = glCreateProgram();
+    glProgramParameteri(entry.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+        GL_TRUE);
+
+    for (int i = 0; i < 2; i++) {
+        const char* source = sources[i]->c_str();
+
+        entry.stages[i] = glCreateShader(stage_types[i]);
+        glShaderSource(entry.stages[i], 1, &source, NULL);
+        glCompileShader(entry.stages[i]);
+        glAttachShader(entry.program, entry.stages[i]);
+    }
+
+    glLinkProgram(entry.program);
+}
+
+// Check the link, report errors and store the binary for the next launch.
+bool ShaderCache::finishCompile(Entry& entry) {
+    GLint linked = GL_FALSE;
+    glGetProgramiv(entry.program, GL_LINK_STATUS, &linked);
+
+    if (linked == GL_FALSE) {
+        for (int i = 0; i < 2; i++) printLog(entry.stages[i], false);
+        printLog(entry.program, true);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        glDetachShader(entry.program, entry.stages[i]);
+        glDeleteShader(entry.stages[i]);
+        entry.stages[i] = GL_NONE;
+    }
+
+    if (linked == GL_FALSE) {
+        glDeleteProgram(entry.program);
+        entry.program = GL_NONE;
+        return false;
+    }
+
+    this->saveBinary(entry);
+    return true;
+}
+
+// With parallel compilation, poll the completion status instead of blocking
+// on the first program. Without it, the link status query blocks anyway.
+void ShaderCache::waitForCompletion(const std::vector<Entry*>& entries) {
+    if (!this->parallel) return;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(entries[i]->program, GL_COMPLETION_STATUS_KHR, &done);
+
+        while (done == GL_FALSE) {
+            std::this_thread::yield();
+            glGetProgramiv(entries[i]->program, GL_COMPLETION_STATUS_KHR, &done);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+/**
+* Description: Shader program cache. Programs are registered up front, then
+* built together: linked binaries are reused from disk when the sources and
+* the driver match, the rest are compiled in parallel (KHR_parallel_shader_compile)
+* and saved for the next launch.
+*/
+
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+// Where program binaries are kept, relative to the working directory.
+#define SHADER_CACHE_DIRECTORY "shader_cache"
+
+class ShaderCache {
+public:
+    ShaderCache(const std::string& directory);
+    ~ShaderCache();
+
+    // Register a program and return its id. Nothing is compiled until build.
+    int add(const std::string& name, const std::string& vertex_source,
+        const std::string& fragment_source);
+
+    // Load or compile every program registered since the last build. Blocks
+    // until they are all linked.
+    void build();
+
+    // Recompile a program from new sources. The old program stays in use
+    // unless the new one links, in which case it is swapped in and true is
+    // returned. Uniform state must then be set again on the new program.
+    bool reload(int id, const std::string& vertex_source,
+        const std::string& fragment_source);
+
+    GLuint getProgram(int id);
+
+private:
+    struct Entry {
+        std::string name;
+        std::string vertex_source;
+        std::string fragment_source;
+        GLuint program;
+        GLuint stages[2];
+    };
+
+    std::string getBinaryPath(const Entry& entry);
+    bool loadBinary(Entry& entry);
+    void saveBinary(const Entry& entry);
+    void startCompile(Entry& entry);
+    bool finishCompile(Entry& entry);
+    void waitForCompletion(const std::vector<Entry*>& entries);
+
+    std::string directory;
+    std::string driver;
+    bool parallel;
+    bool binaries;
+    std::vector<Entry> entries;
+};
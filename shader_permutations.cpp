@@ -0,0 +1,93 @@
+/**
+* Description: Specialized variants of one shader program. Every combination
+* of the options is compiled with its own #defines, so state that is constant
+* over a draw turns into dead code instead of a branch per fragment.
+*/
+
+#include "shader_permutations.h"
+#include <assert.h>
+
+ShaderPermutations::ShaderPermutations(ShaderCache* cache,
+    const std::string& name, const std::string& vertex_source,
+    const std::string& fragment_source, const std::vector<std::string>& options,
+    const std::vector<int>& counts) {
+    assert(options.size() == counts.size());
+
+    this->cache = cache;
+    this->options = options;
+    this->counts = counts;
+
+    int count = 1;
+    for (size_t i = 0; i < counts.size(); i++) count *= counts[i];
+
+    for (int index = 0; index < count; index++) {
+        std::string defines = this->getDefines(index);
+
+        // The name tells the variants apart in the cache directory.
+        std::string variant = name;
+        for (int rest = index, i = 0; i < (int)counts.size(); i++) {
+            variant += "-" + std::to_string(rest % counts[i]);
+            rest /= counts[i];
+        }
+
+        this->ids.push_back(cache->add(variant,
+            insertDefines(vertex_source, defines),
+            insertDefines(fragment_source, defines)));
+    }
+}
+
+bool ShaderPermutations::reload(const std::string& vertex_source,
+    const std::string& fragment_source) {
+    bool changed = false;
+
+    for (int index = 0; index < (int)this->ids.size(); index++) {
+        std::string defines = this->getDefines(index);
+
+        changed |= this->cache->reload(this->ids[index],
+            insertDefines(vertex_source, defines),
+            insertDefines(fragment_source, defines));
+    }
+
+    return changed;
+}
+
+// The index is the values read as a mixed radix number, first option lowest.
+GLuint ShaderPermutations::getProgram(const int values[]) {
+    int index = 0;
+    for (int i = (int)this->counts.size() - 1; i >= 0; i--) {
+        assert(values[i] >= 0 && values[i] < this->counts[i]);
+        index = index * this->counts[i] + values[i];
+    }
+
+    return this->cache->getProgram(this->ids[index]);
+}
+
+GLuint ShaderPermutations::getProgram(int index) {
+    return this->cache->getProgram(this->ids[index]);
+}
+
+int ShaderPermutations::getCount() { return (int)this->ids.size(); }
+
+std::string ShaderPermutations::getDefines(int index) {
+    std::string defines;
+
+    for (size_t i = 0; i < this->options.size(); i++) {
+        defines += "#define " + this->options[i] + " " +
+            std::to_string(index % this->counts[i]) + "\n";
+        index /= this->counts[i];
+    }
+
+    return defines;
+}
+
+// #version has to stay the first statement, so the defines go right after it.
+std::string ShaderPermutations::insertDefines(const std::string& source,
+    const std::string& defines) {
+    size_t version = source.find("#version");
+    if (version == std::string::npos) return defines + source;
+
+    size_t line_end = source.find('\n', version);
+    if (line_end == std::string::npos) return source + "\n" + defines;
+
+    return source.substr(0, line_end + 1) + defines + source.substr(line_end + 1);
+}
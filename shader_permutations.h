@@ -0,0 +1,42 @@
+/**
+* Description: Specialized variants of one shader program. Every combination
+* of the options is compiled with its own #defines, so state that is constant
+* over a draw turns into dead code instead of a branch per fragment.
+*/
+
+#pragma once
+
+#include "shader_cache.h"
+#include <string>
+#include <vector>
+
+class ShaderPermutations {
+public:
+    // Each option is a #define taking the values 0 to count - 1. The variants
+    // are registered with the cache and built by its next build().
+    ShaderPermutations(ShaderCache* cache, const std::string& name,
+        const std::string& vertex_source, const std::string& fragment_source,
+        const std::vector<std::string>& options, const std::vector<int>& counts);
+
+    // Rebuild every variant from new sources. Returns true if any of them
+    // changed, in which case their uniform state must be set again.
+    bool reload(const std::string& vertex_source,
+        const std::string& fragment_source);
+
+    // Variant for one value per option, in the order given to the constructor.
+    GLuint getProgram(const int values[]);
+
+    // Variant by index, to visit all of them.
+    GLuint getProgram(int index);
+    int getCount();
+
+private:
+    std::string getDefines(int index);
+    static std::string insertDefines(const std::string& source,
+        const std::string& defines);
+
+    ShaderCache* cache;
+    std::vector<std::string> options;
+    std::vector<int> counts;
+    std::vector<int> ids;
+};
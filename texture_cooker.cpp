@@ -0,0 +1,291 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Texture cooking. A decoded image gets its whole mip chain, filtered in linear light, and
+// every level is block compressed (BC1 without alpha, BC3 with it) so it can be uploaded as is, with
+// no glGenerateMipmap and a quarter to an eighth of the memory.
+// ------------------------------------------------ -------------------------------------------------
+
+#include "texture_cooker.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace texture{
+    //work(begin, end) over [0, count), split between the cores, on this thread alone if there is little of it
+    template <typename Work>
+    static void _parallelFor(unsigned int count, const Work &work){
+        unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::min(threads, std::max(1u, count / TEXTURE_COOK_MIN_ROWS));
+        if (threads == 1){
+            work(0u, count);
+            return;
+        }
+
+        std::vector<std::thread> pool;
+        for (unsigned int t = 1; t < threads; t++){
+            pool.push_back(std::thread(std::cref(work), count * t / threads, count * (t + 1) / threads));
+        }
+        work(0u, count / threads);
+        for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    }
+
+    static float _toLinear(float value){
+        return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+    }
+    static std::uint8_t _toSRGB(float value){
+        value = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1 / 2.4f) - 0.055f;
+        return (std::uint8_t)(std::min(std::max(value, 0.0f), 1.0f) * 255 + 0.5f);
+    }
+
+    void _buildMipChain(const std::vector<std::uint8_t> &pixels, unsigned int width, unsigned int height, unsigned int channels,
+        std::vector<TextureLevel> &levels){
+        levels.clear();
+        TextureLevel top = { width, height, pixels };
+        levels.push_back(top);
+
+        //filtering works on linear values, alpha is already linear
+        float linear[256];
+        for (int i = 0; i < 256; i++) linear[i] = _toLinear(i / 255.0f);
+        std::vector<float> current(pixels.size()), next;
+        _parallelFor(height, [&](unsigned int begin, unsigned int end){
+            for (size_t i = (size_t)begin * width * channels; i < (size_t)end * width * channels; i++){
+                current[i] = (i % channels == 3) ? pixels[i] / 255.0f : linear[pixels[i]];
+            }
+        });
+
+        unsigned int w = width, h = height;
+        while (w > 1 || h > 1){
+            unsigned int next_w = std::max(1u, w / 2), next_h = std::max(1u, h / 2);
+            TextureLevel level = { next_w, next_h, std::vector<std::uint8_t>((size_t)next_w * next_h * channels) };
+            next.resize(level.data.size());
+
+            //box filter, a single row or column is averaged with itself
+            _parallelFor(next_h, [&](unsigned int begin, unsigned int end){
+                for (unsigned int y = begin; y < end; y++){
+                    size_t row0 = (size_t)std::min(y * 2, h - 1) * w, row1 = (size_t)std::min(y * 2 + 1, h - 1) * w;
+                    for (unsigned int x = 0; x < next_w; x++){
+                        unsigned int x0 = std::min(x * 2, w - 1), x1 = std::min(x * 2 + 1, w - 1);
+                        for (unsigned int c = 0; c < channels; c++){
+                            float value = (current[(row0 + x0) * channels + c] + current[(row0 + x1) * channels + c]
+                                + current[(row1 + x0) * channels + c] + current[(row1 + x1) * channels + c]) * 0.25f;
+                            size_t i = ((size_t)y * next_w + x) * channels + c;
+                            next[i] = value;
+                            level.data[i] = (c == 3) ? (std::uint8_t)(value * 255 + 0.5f) : _toSRGB(value);
+                        }
+                    }
+                }
+            });
+
+            levels.push_back(std::move(level));
+            current.swap(next);
+            w = next_w;
+            h = next_h;
+        }
+    }
+
+    //-------------------------------------------------------------------------------------------------
+
+    //block compression
+    static std::uint16_t _pack565(const float color[3]){
+        int r = (int)(std::min(std::max(color[0], 0.0f), 255.0f) * 31 / 255 + 0.5f);
+        int g = (int)(std::min(std::max(color[1], 0.0f), 255.0f) * 63 / 255 + 0.5f);
+        int b = (int)(std::min(std::max(color[2], 0.0f), 255.0f) * 31 / 255 + 0.5f);
+        return (std::uint16_t)((r << 11) | (g << 5) | b);
+    }
+    static void _unpack565(std::uint16_t packed, int color[3]){
+        int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    //best of the four colors between the endpoints for every pixel, returns the squared error
+    //the endpoints are ordered so the block decodes in four color mode
+    static unsigned int _fitIndices(const std::uint8_t block[16][4], std::uint16_t &color0, std::uint16_t &color1, std::uint32_t &indices){
+        if (color0 < color1) std::swap(color0, color1);
+
+        int palette[4][3];
+        _unpack565(color0, palette[0]);
+        _unpack565(color1, palette[1]);
+        for (int c = 0; c < 3; c++){
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        unsigned int error = 0;
+        indices = 0;
+        for (int p = 0; p < 16; p++){
+            unsigned int best = 0, best_error = ~0u;
+            //equal endpoints decode as index 0 only
+            for (unsigned int i = 0; i < (color0 == color1 ? 1u : 4u); i++){
+                int dr = block[p][0] - palette[i][0], dg = block[p][1] - palette[i][1], db = block[p][2] - palette[i][2];
+                unsigned int e = dr * dr + dg * dg + db * db;
+                if (e < best_error){
+                    best_error = e;
+                    best = i;
+                }
+            }
+            indices |= best << (p * 2);
+            error += best_error;
+        }
+        return error;
+    }
+
+    //endpoints from the principal axis of the colors, then refit by least squares to the chosen indices
+    static void _encodeColorBlock(const std::uint8_t block[16][4], std::uint8_t *out){
+        float mean[3] = { 0, 0, 0 };
+        for (int p = 0; p < 16; p++){
+            for (int c = 0; c < 3; c++) mean[c] += block[p][c] / 16.0f;
+        }
+        float covariance[3][3] = {};
+        for (int p = 0; p < 16; p++){
+            float d[3] = { block[p][0] - mean[0], block[p][1] - mean[1], block[p][2] - mean[2] };
+            for (int i = 0; i < 3; i++){
+                for (int j = 0; j < 3; j++) covariance[i][j] += d[i] * d[j];
+            }
+        }
+
+        //power iteration from the row of the widest channel
+        int widest = 0;
+        for (int c = 1; c < 3; c++){
+            if (covariance[c][c] > covariance[widest][widest]) widest = c;
+        }
+        float axis[3] = { covariance[widest][0], covariance[widest][1], covariance[widest][2] };
+        for (int iteration = 0; iteration < 8; iteration++){
+            float v[3];
+            for (int i = 0; i < 3; i++) v[i] = covariance[i][0] * axis[0] + covariance[i][1] * axis[1] + covariance[i][2] * axis[2];
+            float largest = std::max(fabsf(v[0]), std::max(fabsf(v[1]), fabsf(v[2])));
+            if (largest == 0) break;
+            for (int i = 0; i < 3; i++) axis[i] = v[i] / largest;
+        }
+
+        //the pixels furthest along the axis are the first endpoints
+        int lowest = 0, highest = 0;
+        float low = 1e30f, high = -1e30f;
+        for (int p = 0; p < 16; p++){
+            float t = block[p][0] * axis[0] + block[p][1] * axis[1] + block[p][2] * axis[2];
+            if (t < low){ low = t; lowest = p; }
+            if (t > high){ high = t; highest = p; }
+        }
+        float end0[3] = { (float)block[highest][0], (float)block[highest][1], (float)block[highest][2] };
+        float end1[3] = { (float)block[lowest][0], (float)block[lowest][1], (float)block[lowest][2] };
+        std::uint16_t color0 = _pack565(end0), color1 = _pack565(end1);
+        std::uint32_t indices;
+        unsigned int error = _fitIndices(block, color0, color1, indices);
+
+        //weight of color0 for every index, solve for the endpoints that fit those weights best
+        static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0, bb = 0, ab = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+        for (int p = 0; p < 16; p++){
+            float a = weights[(indices >> (p * 2)) & 3], b = 1 - a;
+            aa += a * a;
+            bb += b * b;
+            ab += a * b;
+            for (int c = 0; c < 3; c++){
+                ax[c] += a * block[p][c];
+                bx[c] += b * block[p][c];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if (fabsf(determinant) > 1e-6f){
+            for (int c = 0; c < 3; c++){
+                end0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+                end1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+            }
+            std::uint16_t refit0 = _pack565(end0), refit1 = _pack565(end1);
+            std::uint32_t refit_indices;
+            if (_fitIndices(block, refit0, refit1, refit_indices) < error){
+                color0 = refit0;
+                color1 = refit1;
+                indices = refit_indices;
+            }
+        }
+
+        out[0] = (std::uint8_t)color0;
+        out[1] = (std::uint8_t)(color0 >> 8);
+        out[2] = (std::uint8_t)color1;
+        out[3] = (std::uint8_t)(color1 >> 8);
+        for (int i = 0; i < 4; i++) out[4 + i] = (std::uint8_t)(indices >> (i * 8));
+    }
+
+    //BC3 alpha: the extremes as endpoints, eight interpolated steps between them
+    static void _encodeAlphaBlock(const std::uint8_t block[16][4], std::uint8_t *out){
+        int alpha0 = 0, alpha1 = 255;
+        for (int p = 0; p < 16; p++){
+            alpha0 = std::max(alpha0, (int)block[p][3]);
+            alpha1 = std::min(alpha1, (int)block[p][3]);
+        }
+
+        int palette[8] = { alpha0, alpha1 };
+        for (int i = 2; i < 8; i++) palette[i] = ((8 - i) * alpha0 + (i - 1) * alpha1 + 3) / 7;
+
+        std::uint64_t indices = 0;
+        if (alpha0 != alpha1){
+            for (int p = 0; p < 16; p++){
+                std::uint64_t best = 0;
+                int best_error = 256;
+                for (int i = 0; i < 8; i++){
+                    int e = abs(block[p][3] - palette[i]);
+                    if (e < best_error){
+                        best_error = e;
+                        best = i;
+                    }
+                }
+                indices |= best << (p * 3);
+            }
+        }
+
+        out[0] = (std::uint8_t)alpha0;
+        out[1] = (std::uint8_t)alpha1;
+        for (int i = 0; i < 6; i++) out[2 + i] = (std::uint8_t)(indices >> (i * 8));
+    }
+
+    void _compressLevel(const TextureLevel &level, unsigned int channels, TextureLevel &compressed){
+        unsigned int blocks_x = (level.width + 3) / 4, blocks_y = (level.height + 3) / 4;
+        unsigned int block_size = (channels == 4) ? 16 : 8;
+        compressed.width = level.width;
+        compressed.height = level.height;
+        compressed.data.resize((size_t)blocks_x * blocks_y * block_size);
+
+        _parallelFor(blocks_y, [&](unsigned int begin, unsigned int end){
+            std::uint8_t block[16][4];
+            for (unsigned int by = begin; by < end; by++){
+                for (unsigned int bx = 0; bx < blocks_x; bx++){
+                    for (unsigned int p = 0; p < 16; p++){
+                        unsigned int x = std::min(bx * 4 + p % 4, level.width - 1), y = std::min(by * 4 + p / 4, level.height - 1);
+                        const std::uint8_t *pixel = &level.data[((size_t)y * level.width + x) * channels];
+                        block[p][0] = pixel[0];
+                        block[p][1] = pixel[1];
+                        block[p][2] = pixel[2];
+                        block[p][3] = (channels == 4) ? pixel[3] : 255;
+                    }
+
+                    std::uint8_t *out = &compressed.data[((size_t)by * blocks_x + bx) * block_size];
+                    if (channels == 4){
+                        _encodeAlphaBlock(block, out);
+                        out += 8;
+                    }
+                    _encodeColorBlock(block, out);
+                }
+            }
+        });
+    }
+
+    void _cookTexture(const std::vector<std::uint8_t> &pixels, unsigned int width, unsigned int height, unsigned int channels,
+        bool compress, TextureData &texture){
+        CpuProfileZone zone("texture cook");
+        _buildMipChain(pixels, width, height, channels, texture.levels);
+
+        if (!compress){
+            texture.format = (channels == 4) ? GL_SRGB8_ALPHA8 : GL_SRGB8;
+            return;
+        }
+
+        texture.format = (channels == 4) ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+        for (size_t i = 0; i < texture.levels.size(); i++){
+            TextureLevel compressed;
+            _compressLevel(texture.levels[i], channels, compressed);
+            texture.levels[i].data.swap(compressed.data);
+        }
+    }
+}
@@ -0,0 +1,26 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Texture cooking. A decoded image gets its whole mip chain, filtered in linear light, and
+// every level is block compressed (BC1 without alpha, BC3 with it) so it can be uploaded as is, with
+// no glGenerateMipmap and a quarter to an eighth of the memory.
+// ------------------------------------------------ -------------------------------------------------
+
+#pragma once
+
+#include "texture_loader.h"
+
+// Rows of blocks (or pixels) given to each cooking thread, at least.
+#define TEXTURE_COOK_MIN_ROWS 16
+
+namespace texture{
+    // Build every level down to 1x1 from tightly packed sRGB rows with 3 or 4 channels. Color is averaged
+    // in linear light, alpha as is. Level 0 is a copy of pixels.
+    void _buildMipChain(const std::vector<std::uint8_t> &pixels, unsigned int width, unsigned int height, unsigned int channels,
+        std::vector<TextureLevel> &levels);
+
+    // Encode one level as 4x4 blocks, BC1 for 3 channels, BC3 for 4. Edge blocks repeat the last row and column.
+    void _compressLevel(const TextureLevel &level, unsigned int channels, TextureLevel &compressed);
+
+    // Mips and, if compress, block compression of a decoded image, spread over the cores.
+    void _cookTexture(const std::vector<std::uint8_t> &pixels, unsigned int width, unsigned int height, unsigned int channels,
+        bool compress, TextureData &texture);
+}
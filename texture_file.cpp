@@ -0,0 +1,117 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Cooked texture files. A header with the internal format and the size and place of every
+// mip level, then the levels, aligned and ready for glCompressedTexImage2D.
+// ------------------------------------------------ -------------------------------------------------
+
+#include "texture_file.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <stdio.h>
+#include <sys/stat.h>
+
+namespace texture{
+    static uint64_t _align(uint64_t offset){
+        return (offset + TEXTURE_FILE_ALIGNMENT - 1) / TEXTURE_FILE_ALIGNMENT * TEXTURE_FILE_ALIGNMENT;
+    }
+
+    size_t _textureLevelSize(unsigned int format, unsigned int width, unsigned int height){
+        size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+        switch (format){
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: return blocks * 8;
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT: return blocks * 16;
+        case GL_SRGB8: return (size_t)width * height * 3;
+        case GL_SRGB8_ALPHA8: return (size_t)width * height * 4;
+        default: return 0;
+        }
+    }
+
+    //format, full chain and level ranges, checked before any level is read
+    static bool _isValidHeader(const TextureFileHeader *header, uint64_t size){
+        if (header->magic != TEXTURE_FILE_MAGIC || header->version != TEXTURE_FILE_VERSION) return false;
+        if (header->level_count < 1 || header->level_count > TEXTURE_FILE_MAX_LEVELS) return false;
+        if (header->width == 0 || header->height == 0) return false;
+
+        unsigned int width = header->width, height = header->height;
+        for (uint32_t i = 0; i < header->level_count; i++){
+            size_t expected = _textureLevelSize(header->format, width, height);
+            if (expected == 0 || header->level_size[i] != expected) return false;
+            if (header->level_offset[i] > size || header->level_size[i] > size - header->level_offset[i]) return false;
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+        }
+        return true;
+    }
+
+    bool saveTextureFile(const std::string &filename, const TextureData &texture){
+        static const char padding[TEXTURE_FILE_ALIGNMENT] = { 0 };
+        TextureFileHeader header = {};
+        if (texture.levels.empty() || texture.levels.size() > TEXTURE_FILE_MAX_LEVELS) return false;
+
+        header.magic = TEXTURE_FILE_MAGIC;
+        header.version = TEXTURE_FILE_VERSION;
+        header.format = texture.format;
+        header.width = texture.levels[0].width;
+        header.height = texture.levels[0].height;
+        header.level_count = (uint32_t)texture.levels.size();
+        uint64_t end = sizeof(TextureFileHeader);
+        for (uint32_t i = 0; i < header.level_count; i++){
+            header.level_offset[i] = _align(end);
+            header.level_size[i] = texture.levels[i].data.size();
+            end = header.level_offset[i] + header.level_size[i];
+        }
+
+        FILE *file = fopen(filename.c_str(), "wb");
+        if (!file) return false;
+
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+        end = sizeof(header);
+        for (uint32_t i = 0; i < header.level_count; i++){
+            uint64_t gap = header.level_offset[i] - end;
+            written = written && fwrite(padding, 1, gap, file) == gap;
+            written = written && fwrite(texture.levels[i].data.data(), 1, header.level_size[i], file) == header.level_size[i];
+            end = header.level_offset[i] + header.level_size[i];
+        }
+        written = (fclose(file) == 0) && written;
+
+        //don't leave a truncated file behind, it would look newer than the source
+        if (!written) remove(filename.c_str());
+        return written;
+    }
+
+    bool readTextureFile(const std::string &filename, TextureData &texture){
+        MappedFile file(filename);
+        if (!file.isOpen() || file.getSize() < sizeof(TextureFileHeader)) return false;
+
+        const char *data = file.getData();
+        const TextureFileHeader *header = (const TextureFileHeader*)data;
+        if (!_isValidHeader(header, file.getSize())) return false;
+
+        texture.format = header->format;
+        texture.levels.resize(header->level_count);
+        unsigned int width = header->width, height = header->height;
+        for (uint32_t i = 0; i < header->level_count; i++){
+            const std::uint8_t *level = (const std::uint8_t*)(data + header->level_offset[i]);
+            texture.levels[i].width = width;
+            texture.levels[i].height = height;
+            texture.levels[i].data.assign(level, level + header->level_size[i]);
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+        }
+        return true;
+    }
+
+    std::string _compiledTexturePath(const std::string &filename){
+        size_t dot = filename.find_last_of('.');
+        size_t separator = filename.find_last_of("/\\");
+        if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) return filename + TEXTURE_FILE_EXTENSION;
+        return filename.substr(0, dot) + TEXTURE_FILE_EXTENSION;
+    }
+
+    bool _isCompiledTextureCurrent(const std::string &compiled, const std::string &source){
+        struct stat compiled_stat, source_stat;
+        if (stat(compiled.c_str(), &compiled_stat) != 0) return false;
+        //without a source the cooked texture is all there is
+        if (stat(source.c_str(), &source_stat) != 0) return true;
+        return compiled_stat.st_mtime >= source_stat.st_mtime;
+    }
+}
@@ -0,0 +1,43 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Cooked texture files. A header with the internal format and the size and place of every
+// mip level, then the levels, aligned and ready for glCompressedTexImage2D. The file is mapped and read
+// level by level, the way KTX lays them out, without its key/value data.
+// ------------------------------------------------ -------------------------------------------------
+
+#pragma once
+
+#include "texture_loader.h"
+#include <stdint.h>
+
+#define TEXTURE_FILE_MAGIC 0x58455443 // "CTEX"
+#define TEXTURE_FILE_VERSION 1
+#define TEXTURE_FILE_EXTENSION ".ctex"
+
+// Levels start on this boundary, counted from the start of the file.
+#define TEXTURE_FILE_ALIGNMENT 16
+// Enough for a 65536 texel side.
+#define TEXTURE_FILE_MAX_LEVELS 17
+
+namespace texture{
+    struct TextureFileHeader{
+        uint32_t magic, version;
+        //GL internal format, one of those _cookTexture produces
+        uint32_t format, width, height, level_count;
+        uint64_t level_offset[TEXTURE_FILE_MAX_LEVELS], level_size[TEXTURE_FILE_MAX_LEVELS];
+    };
+
+    // Write a cooked texture. Returns false if the file can't be written.
+    bool saveTextureFile(const std::string &filename, const TextureData &texture);
+
+    // Map a cooked texture and read its levels. Returns false if the file is missing or not a valid cooked texture
+    // of this version.
+    bool readTextureFile(const std::string &filename, TextureData &texture);
+
+    // Bytes in a level of a format _cookTexture produces, 0 for any other format.
+    size_t _textureLevelSize(unsigned int format, unsigned int width, unsigned int height);
+
+    // Where the cooked version of a BMP lives: same path, TEXTURE_FILE_EXTENSION extension.
+    std::string _compiledTexturePath(const std::string &filename);
+    // True if compiled exists and is not older than source.
+    bool _isCompiledTextureCurrent(const std::string &compiled, const std::string &source);
+}
@@ -6,6 +6,15 @@
 
 #pragma once
 #include "texture_loader.h"
+#include "texture_cooker.h"
+#include "texture_file.h"
+#include "mapped_file.h"
+#include "gl_state.h"
+#include <cstring>
+#include <stdexcept>
+#if defined(__SSSE3__) || defined(__AVX__)
+#   include <immintrin.h>
+#endif
 
 namespace texture{
     //definition forward
@@ -51,79 +60,208 @@ namespace texture{
 	// Does not support compression!
 	// Load a BMP file into an array unsigned char
 	// Returns a pointer to an array containing texture data and arguments submitted by reference values in width and height
+	// Decoded by loadBMP, only 24 bit files are accepted, rows start at the bottom
     unsigned char* _loadBMPFile(const std::string &filename, unsigned int &width, unsigned int &height){
-        // Header data structures
-        struct header{
-            unsigned char type[2];
-            int f_lenght;
-            short rezerved1;
-            short rezerved2;
-            int offBits;
-        };
-        struct header_info{
-            int size;
-            int width;
-            int height;
-            short planes;
-            short bitCount;
-            int compresion;
-            int sizeImage;
-            int xPelsPerMeter;
-            int yPelsPerMeter;
-            int clrUsed;
-            int clrImportant;
-        };
-
-        //read the file
-        std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
-        if (!file.good()){
-            std::cout << "Texture Loader: Nu am gasit fisierul bmp " << filename << " sau nu am drepturile sa il deschid!" << std::endl;
-            width = 0;
-            height = 0;
+        int w, h, channels;
+        std::vector<std::uint8_t> pixels;
+
+        width = 0;
+        height = 0;
+        try{
+            loadBMP(filename, w, h, channels, pixels);
+        }
+        catch (const std::exception &e){
+            std::cout << "Texture Loader: " << filename << ": " << e.what() << std::endl;
+            return NULL;
+        }
+        if (channels != 3){
+            std::cout << "Texture Loader: " << filename << " is not a 24 bit bmp" << std::endl;
             return NULL;
         }
         std::cout << "Texture Loader: Loaded file " << filename << std::endl;
 
-        header h; header_info h_info;
-        file.read((char*)&(h.type[0]), sizeof(char));
-        file.read((char*)&(h.type[1]), sizeof(char));
-        file.read((char*)&(h.f_lenght), sizeof(int));
-        file.read((char*)&(h.rezerved1), sizeof(short));
-        file.read((char*)&(h.rezerved2), sizeof(short));
-        file.read((char*)&(h.offBits), sizeof(int));
-        file.read((char*)&(h_info), sizeof(header_info));
-
-        //allocate memory (1 pixel is 3 components R, G, B)
-        unsigned char *data = new unsigned char[h_info.width*h_info.height * 3];
-
-        // check if there are groups of 4 bytes per line
-        long padd = 0;
-        if ((h_info.width * 3) % 4 != 0) padd = 4 - (h_info.width * 3) % 4;
-
-        //save height &width
-        width = h_info.width;
-        height = h_info.height;
-
-        long pointer;
-        unsigned char r, g, b;
-        for (unsigned int i = 0; i < height; i++)
-        {
-            for (unsigned int j = 0; j < width; j++)
-            {
-                file.read((char*)&b, 1);	//in bmp order in pixel is b,g,r (specific windows)
-                file.read((char*)&g, 1);
-                file.read((char*)&r, 1);
-
-                pointer = (i*width + j) * 3;
-                data[pointer] = r;
-                data[pointer + 1] = g;
-                data[pointer + 2] = b;
+        unsigned char *data = new unsigned char[pixels.size()];
+        memcpy(data, pixels.data(), pixels.size());
+        width = w;
+        height = h;
+        return data;
+    }
+
+    bool readTexture(const std::string &filename, bool compressed, TextureData &texture){
+        std::string compiled = _compiledTexturePath(filename);
+        if (compressed && _isCompiledTextureCurrent(compiled, filename) && readTextureFile(compiled, texture)){
+            std::cout << "Texture Loader: read cooked file " << compiled << std::endl;
+            return true;
+        }
+
+        _compileTexture(filename, compiled, compressed, texture);
+        return !texture.levels.empty();
+    }
+
+    size_t _textureSize(const TextureData &texture){
+        size_t size = 0;
+        for (size_t i = 0; i < texture.levels.size(); i++){
+            size += _textureLevelSize(texture.format, texture.levels[i].width, texture.levels[i].height);
+        }
+        return size;
+    }
+
+    void stageTexture(TextureData &texture, std::uint8_t *destination){
+        for (size_t i = 0; i < texture.levels.size(); i++){
+            memcpy(destination, texture.levels[i].data.data(), texture.levels[i].data.size());
+            destination += texture.levels[i].data.size();
+            std::vector<std::uint8_t>().swap(texture.levels[i].data);
+        }
+    }
+
+    //every level from its data, or one after the other from offset in the bound unpack buffer
+    static unsigned int _uploadLevels(const TextureData &texture, bool staged, size_t offset){
+        unsigned int gl_texture_object;
+        glGenTextures(1, &gl_texture_object);
+        GLState::bindTexture(0, GL_TEXTURE_2D, gl_texture_object);
+
+        //every level comes with the data, nothing to generate
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size() - 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t i = 0; i < texture.levels.size(); i++){
+            const TextureLevel &level = texture.levels[i];
+            size_t size = _textureLevelSize(texture.format, level.width, level.height);
+            const void *pixels = staged ? (const void*)offset : (const void*)level.data.data();
+            if (texture.format == GL_SRGB8 || texture.format == GL_SRGB8_ALPHA8){
+                glTexImage2D(GL_TEXTURE_2D, (GLint)i, texture.format, level.width, level.height, 0,
+                    (texture.format == GL_SRGB8) ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            }
+            else{
+                glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, texture.format, level.width, level.height, 0, (GLsizei)size, pixels);
             }
+            offset += size;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        return gl_texture_object;
+    }
+
+    unsigned int uploadTexture(const TextureData &texture){
+        return _uploadLevels(texture, false, 0);
+    }
+
+    unsigned int uploadStagedTexture(const TextureData &texture, size_t offset){
+        return _uploadLevels(texture, true, offset);
+    }
+
+    void _compileTexture(const std::string &filename, const std::string &compiled, bool compressed, TextureData &texture){
+        int width, height, channels;
+        std::vector<std::uint8_t> pixels;
+        texture.levels.clear();
+        try{
+            loadBMP(filename, width, height, channels, pixels);
+        }
+        catch (const std::exception &e){
+            std::cout << "Texture Loader: " << filename << ": " << e.what() << std::endl;
+            return;
+        }
 
-            file.seekg(padd, std::ios_base::cur);
+        _cookTexture(pixels, width, height, channels, compressed, texture);
+        std::cout << "Texture Loader: cooked " << filename << " (" << width << "x" << height << ", " << texture.levels.size()
+            << " levels" << (compressed ? ", block compressed" : "") << ")" << std::endl;
+
+        if (compressed && !saveTextureFile(compiled, texture)){
+            std::cout << "Texture Loader: could not write " << compiled << std::endl;
         }
-        file.close();
+    }
 
-        return data;
+    //little endian fields of the bmp headers
+    static std::uint32_t _readU32(const std::uint8_t *p){
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((std::uint32_t)p[3] << 24);
+    }
+    static std::uint16_t _readU16(const std::uint8_t *p){
+        return (std::uint16_t)(p[0] | (p[1] << 8));
+    }
+
+    //BGR to RGB; with SSSE3 five pixels per shuffle, as long as 16 bytes can be read and written
+    static void _swizzleBGR(const std::uint8_t *source, std::uint8_t *destination, size_t pixels){
+        size_t i = 0;
+#if defined(__SSSE3__) || defined(__AVX__)
+        const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, -1);
+        for (; i + 6 <= pixels; i += 5){
+            __m128i bgr = _mm_loadu_si128((const __m128i*)(source + i * 3));
+            _mm_storeu_si128((__m128i*)(destination + i * 3), _mm_shuffle_epi8(bgr, mask));
+        }
+#endif
+        for (; i < pixels; i++){
+            destination[i * 3] = source[i * 3 + 2];
+            destination[i * 3 + 1] = source[i * 3 + 1];
+            destination[i * 3 + 2] = source[i * 3];
+        }
+    }
+
+    //BGRA to RGBA, eight pixels per shuffle with AVX2, four with SSSE3
+    static void _swizzleBGRA(const std::uint8_t *source, std::uint8_t *destination, size_t pixels){
+        size_t i = 0;
+#if defined(__AVX2__)
+        const __m256i mask256 = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; i + 8 <= pixels; i += 8){
+            __m256i bgra = _mm256_loadu_si256((const __m256i*)(source + i * 4));
+            _mm256_storeu_si256((__m256i*)(destination + i * 4), _mm256_shuffle_epi8(bgra, mask256));
+        }
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+        const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; i + 4 <= pixels; i += 4){
+            __m128i bgra = _mm_loadu_si128((const __m128i*)(source + i * 4));
+            _mm_storeu_si128((__m128i*)(destination + i * 4), _mm_shuffle_epi8(bgra, mask));
+        }
+#endif
+        for (; i < pixels; i++){
+            destination[i * 4] = source[i * 4 + 2];
+            destination[i * 4 + 1] = source[i * 4 + 1];
+            destination[i * 4 + 2] = source[i * 4];
+            destination[i * 4 + 3] = source[i * 4 + 3];
+        }
+    }
+}
+
+void loadBMP(const std::string& filename, int& width, int& height, int& channels, std::vector<std::uint8_t>& data) {
+    MappedFile file(filename);
+    if (!file.isOpen()) { throw std::invalid_argument("Error: File Not Found."); }
+
+    const std::uint8_t* bytes = reinterpret_cast<const std::uint8_t*>(file.getData());
+    const size_t size = file.getSize();
+    if (size < 54 || bytes[0] != 'B' || bytes[1] != 'M') {
+        throw std::invalid_argument("Error: File is not a BMP.");
+    }
+
+    // BI_RGB, or BI_BITFIELDS with the usual masks for 32 bits
+    const std::uint16_t bitsPerPixel = texture::_readU16(bytes + 28);
+    const std::uint32_t compression = texture::_readU32(bytes + 30);
+    if ((bitsPerPixel != 24 && bitsPerPixel != 32) || !(compression == 0 || (compression == 3 && bitsPerPixel == 32))) {
+        throw std::invalid_argument("Error: File is not uncompressed 24 or 32 bits per pixel.");
+    }
+
+    // A negative height stores the rows top down
+    const std::uint32_t offset = texture::_readU32(bytes + 10);
+    const std::int32_t storedWidth = (std::int32_t)texture::_readU32(bytes + 18);
+    const std::int32_t storedHeight = (std::int32_t)texture::_readU32(bytes + 22);
+    const bool topDown = storedHeight < 0;
+    if (storedWidth <= 0 || storedHeight == 0) {
+        throw std::invalid_argument("Error: BMP has no pixels.");
+    }
+
+    channels = bitsPerPixel / 8;
+    width = storedWidth;
+    height = topDown ? -storedHeight : storedHeight;
+    const size_t stride = ((size_t(width) * bitsPerPixel + 31) / 32) * 4;
+    if (offset > size || stride * height > size - offset) {
+        throw std::invalid_argument("Error: BMP is truncated.");
+    }
+
+    // Bottom row first, the origin glTexImage2D expects, so bottom up files
+    // are only swizzled and top down ones read in reverse
+    const size_t rowBytes = size_t(width) * channels;
+    data.resize(rowBytes * height);
+    for (int y = 0; y < height; y++) {
+        const std::uint8_t* source = bytes + offset + stride * (topDown ? height - 1 - y : y);
+        if (channels == 4) texture::_swizzleBGRA(source, &data[y * rowBytes], width);
+        else texture::_swizzleBGR(source, &data[y * rowBytes], width);
     }
-}
\ No newline at end of file
+}
@@ -21,6 +21,8 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <cstdint>
 
 namespace texture{
     //incarca o imagine BMP si creeaza cu ea o textura
@@ -32,4 +34,42 @@ namespace texture{
     //incarca un fisier BMP intr-un array unsigned char
     //returneaza un pointer la un array ce contine datele texturii si valori in argumentele trimise prin referinta width si height
     unsigned char* _loadBMPFile(const std::string &filename, unsigned int &width, unsigned int &height);
-}
\ No newline at end of file
+
+    //one mip level, bottom row first; compressed levels are rows of 4x4 blocks
+    struct TextureLevel{
+        unsigned int width, height;
+        std::vector<std::uint8_t> data;
+    };
+
+    //a texture ready for upload, every level in the same internal format
+    struct TextureData{
+        unsigned int format;
+        std::vector<TextureLevel> levels;
+    };
+
+    //reads a BMP as an uploadable texture without touching OpenGL, safe on any thread
+    //compressed: the cooked file next to it if current, else the BMP is cooked and the file written
+    //uncompressed: the BMP with its mips, for drivers without S3TC
+    //returns false if the BMP can't be read
+    bool readTexture(const std::string &filename, bool compressed, TextureData &texture);
+
+    //creates the OpenGL texture with every level of the data, returns its id
+    unsigned int uploadTexture(const TextureData &texture);
+
+    //bytes of every level together, as stageTexture writes them
+    size_t _textureSize(const TextureData &texture);
+    //copies every level, one after the other, to destination and frees the level data, keeping the sizes
+    //safe on any thread, destination is usually a segment of the UploadRing
+    void stageTexture(TextureData &texture, std::uint8_t *destination);
+    //same as uploadTexture, reading the levels staged at offset in the bound GL_PIXEL_UNPACK_BUFFER
+    unsigned int uploadStagedTexture(const TextureData &texture, size_t offset);
+
+    //loads and cooks filename, writes it to compiled if compressed
+    void _compileTexture(const std::string &filename, const std::string &compiled, bool compressed, TextureData &texture);
+}
+
+/** Loads a 24- or 32-bit BMP file into memory as tightly packed RGB[A] rows,
+    bottom row first, the origin glTexImage2D expects. The file is mapped and
+    swizzled with SSSE3/AVX2 shuffles when the build enables them.
+    Throws std::invalid_argument if the file is missing or not supported. */
+void loadBMP(const std::string& filename, int& width, int& height, int& channels, std::vector<std::uint8_t>& data);
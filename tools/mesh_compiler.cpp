@@ -0,0 +1,52 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Compiles OBJ meshes into the binary format of mesh_file.h, next to each source, so
+// shipped assets never need parsing at startup. The asset manager does the same on the first load.
+//
+// Build as its own executable, with the repository root on the include path, together with
+// mesh_loader.cpp, mesh_simplifier.cpp, mesh_meshlet.cpp, mesh_file.cpp, mapped_file.cpp, gl_state.cpp
+// and cpu_profiler.cpp, linking GLEW (only for its symbols, no GL context is created).
+//
+// Usage: mesh_compiler [--force] file.obj [file.obj ...]
+// Up to date compiled meshes are skipped unless --force is given.
+// ------------------------------------------------ -------------------------------------------------
+
+#include "mesh_loader.h"
+#include "mesh_file.h"
+#include <cstring>
+
+int main(int argc, char** argv){
+    bool force = false;
+    int failures = 0;
+
+    if (argc < 2){
+        std::cout << "Usage: mesh_compiler [--force] file.obj [file.obj ...]" << std::endl;
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--force") == 0){
+            force = true;
+            continue;
+        }
+
+        std::string source = argv[i];
+        std::string compiled = mesh::_compiledMeshPath(source);
+        if (!force && mesh::_isCompiledMeshCurrent(compiled, source)){
+            std::cout << compiled << " is up to date" << std::endl;
+            continue;
+        }
+
+        //compiles and writes the file, reporting what went wrong
+        mesh::MeshData data;
+        mesh::_compileObj(source, compiled, data);
+        if (data.indices.empty() || !mesh::_isCompiledMeshCurrent(compiled, source)){
+            failures++;
+            continue;
+        }
+
+        std::cout << source << " -> " << compiled << " (" << data.vertices.size() << " vertices, " << data.lods.index_count[0] / 3 << " triangles, "
+            << data.lods.count << " levels of detail, " << data.meshlets.size() << " meshlets)" << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+// ------------------------------------------------ -------------------------------------------------
+// Description: Cooks BMP textures into the block compressed format of texture_file.h, next to each
+// source, so shipped textures never need mips or compression at startup. The asset manager does the
+// same on the first load.
+//
+// Build as its own executable, with the repository root on the include path, together with
+// texture_loader.cpp, texture_cooker.cpp, texture_file.cpp, mapped_file.cpp, gl_state.cpp and
+// cpu_profiler.cpp, linking GLEW (only for its symbols, no GL context is created).
+//
+// Usage: texture_compiler [--force] file.bmp [file.bmp ...]
+// Up to date cooked textures are skipped unless --force is given.
+// ------------------------------------------------ -------------------------------------------------
+
+#include "texture_loader.h"
+#include "texture_file.h"
+#include <cstring>
+
+int main(int argc, char** argv){
+    bool force = false;
+    int failures = 0;
+
+    if (argc < 2){
+        std::cout << "Usage: texture_compiler [--force] file.bmp [file.bmp ...]" << std::endl;
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--force") == 0){
+            force = true;
+            continue;
+        }
+
+        std::string source = argv[i];
+        std::string compiled = texture::_compiledTexturePath(source);
+        if (!force && texture::_isCompiledTextureCurrent(compiled, source)){
+            std::cout << compiled << " is up to date" << std::endl;
+            continue;
+        }
+
+        //cooks and writes the file, reporting what went wrong
+        texture::TextureData data;
+        texture::_compileTexture(source, compiled, true, data);
+        if (data.levels.empty() || !texture::_isCompiledTextureCurrent(compiled, source)){
+            failures++;
+            continue;
+        }
+
+        size_t size = 0;
+        for (size_t level = 0; level < data.levels.size(); level++) size += data.levels[level].data.size();
+        std::cout << source << " -> " << compiled << " (" << data.levels[0].width << "x" << data.levels[0].height << ", "
+            << data.levels.size() << " levels, " << size << " bytes)" << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+/**
+* Description: Staging ring for texture uploads. One pixel unpack buffer,
+* persistently mapped and split in segments. Worker threads copy decoded data
+* into a free segment, the GL thread uploads from it with the buffer bound,
+* so the driver reads the data itself, and a fence keeps the segment from
+* being reused until the GPU is done with it.
+*/
+
+#include "upload_ring.h"
+#include <mutex>
+#include <vector>
+
+GLuint UploadRing::buffer = GL_NONE;
+std::uint8_t* UploadRing::mapping = NULL;
+GLsync UploadRing::fences[UPLOAD_RING_SEGMENT_COUNT];
+
+// Free segments, shared with the workers. Segments are otherwise owned by
+// whoever acquired them, then by the GL thread through their fence.
+static std::mutex upload_ring_mutex;
+static std::vector<int> upload_ring_free;
+
+bool UploadRing::initialize() {
+    if (!GLEW_ARB_buffer_storage) return false;
+
+    // Coherent, so what the workers write needs no flush before the upload.
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    const GLsizeiptr size = (GLsizeiptr)UPLOAD_RING_SEGMENT_COUNT * UPLOAD_RING_SEGMENT_SIZE;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+    mapping = (std::uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (!mapping) {
+        glDeleteBuffers(1, &buffer);
+        buffer = GL_NONE;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(upload_ring_mutex);
+    upload_ring_free.clear();
+    for (int i = 0; i < UPLOAD_RING_SEGMENT_COUNT; i++) {
+        fences[i] = NULL;
+        upload_ring_free.push_back(i);
+    }
+    return true;
+}
+
+void UploadRing::shutdown() {
+    if (buffer == GL_NONE) return;
+
+    // The GPU may still be reading, the buffer can't go before it is done.
+    for (int i = 0; i < UPLOAD_RING_SEGMENT_COUNT; i++) {
+        if (!fences[i]) continue;
+        glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fences[i]);
+        fences[i] = NULL;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    buffer = GL_NONE;
+    mapping = NULL;
+
+    std::lock_guard<std::mutex> lock(upload_ring_mutex);
+    upload_ring_free.clear();
+}
+
+int UploadRing::acquire(size_t size) {
+    if (size > UPLOAD_RING_SEGMENT_SIZE) return UPLOAD_RING_NONE;
+
+    std::lock_guard<std::mutex> lock(upload_ring_mutex);
+    if (upload_ring_free.empty()) return UPLOAD_RING_NONE;
+    int segment = upload_ring_free.back();
+    upload_ring_free.pop_back();
+    return segment;
+}
+
+std::uint8_t* UploadRing::getPointer(int segment) {
+    return mapping + (size_t)segment * UPLOAD_RING_SEGMENT_SIZE;
+}
+
+size_t UploadRing::bind(int segment) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    return (size_t)segment * UPLOAD_RING_SEGMENT_SIZE;
+}
+
+void UploadRing::submit(int segment) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void UploadRing::discard(int segment) {
+    std::lock_guard<std::mutex> lock(upload_ring_mutex);
+    upload_ring_free.push_back(segment);
+}
+
+void UploadRing::update() {
+    for (int i = 0; i < UPLOAD_RING_SEGMENT_COUNT; i++) {
+        if (!fences[i]) continue;
+
+        // Only polled, the frame never waits on an upload.
+        GLenum result = glClientWaitSync(fences[i], 0, 0);
+        if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) continue;
+
+        glDeleteSync(fences[i]);
+        fences[i] = NULL;
+        UploadRing::discard(i);
+    }
+}
@@ -0,0 +1,53 @@
+/**
+* Description: Staging ring for texture uploads. One pixel unpack buffer,
+* persistently mapped and split in segments. Worker threads copy decoded data
+* into a free segment, the GL thread uploads from it with the buffer bound,
+* so the driver reads the data itself, and a fence keeps the segment from
+* being reused until the GPU is done with it.
+*/
+
+#pragma once
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstddef>
+
+#define UPLOAD_RING_SEGMENT_COUNT 4
+// Bytes per segment. Larger uploads go straight from memory instead.
+#define UPLOAD_RING_SEGMENT_SIZE (16u << 20)
+
+// No segment, returned by acquire when none can take the data.
+#define UPLOAD_RING_NONE -1
+
+class UploadRing {
+public:
+    // Create and map the buffer. Needs the GL context and
+    // ARB_buffer_storage; without it, returns false and acquire always
+    // returns UPLOAD_RING_NONE.
+    static bool initialize();
+    // Wait for the GPU to finish with every segment and free the buffer.
+    static void shutdown();
+
+    // From any thread. A free segment for size bytes, or UPLOAD_RING_NONE
+    // if all are in use or size doesn't fit in one. Write the data through
+    // getPointer, then hand the segment to the GL thread.
+    static int acquire(size_t size);
+    static std::uint8_t* getPointer(int segment);
+
+    // GL thread. Bind the buffer as GL_PIXEL_UNPACK_BUFFER and return the
+    // offset of the segment, to pass instead of pointers to glTex*Image.
+    static size_t bind(int segment);
+    // GL thread, after the uploads from the segment. Unbind the buffer and
+    // fence the segment, it is free again once the GPU has read it.
+    static void submit(int segment);
+    // GL thread. Give back a segment that was never uploaded from.
+    static void discard(int segment);
+
+    // GL thread, once per frame. Free the segments whose fence has passed.
+    static void update();
+
+private:
+    static GLuint buffer;
+    static std::uint8_t* mapping;
+    static GLsync fences[UPLOAD_RING_SEGMENT_COUNT];
+};
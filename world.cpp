@@ -10,11 +10,17 @@
 #pragma once
 
 #include "world.h"
+#include "gl_state.h"
+#include "cpu_profiler.h"
+#include "quality_governor.h"
+#include "glm\gtc\noise.hpp"
 
 // Initialize the random number seed.
 static std::random_device rd;
 static std::mt19937 rgn(rd());
 
+void World::setSeed(unsigned int seed) { rgn.seed(seed); }
+
 // Vertex initialization.
 WorldVertex::WorldVertex() {
     this->position = glm::vec3(0, 0, 0);
@@ -29,18 +35,28 @@ WorldVertex::WorldVertex(glm::vec3 position, glm::vec3 normal) {
     this->normal = normal;
 }
 
-// Instantiates the world, generates the terrains and binds all the buffers.
-World::World(glm::vec3 position, float radius, unsigned int mode) {
+// Instantiates an empty world, without any blocks. Nothing touches OpenGL
+// until bufferData, so blocks can be generated without a context.
+World::World(glm::vec3 position, float radius) {
     // Cache various values.
     this->radius = radius * WORLD_RADIUS_MULTIPLY;
     this->length = this->radius * 2;
     this->position = position;
-    this->setMode(mode);
-    int i;
+    this->setMode(WORLD_MODE_FRACTAL);
+    this->baked_colors = true;
+    this->terrain_level = 0;
 
     // Initialize the mode blocks.
-    for (i = 0; i < WORLD_MODE_COUNT; i++)
+    for (int i = 0; i < WORLD_MODE_COUNT; i++)
         this->blocks[i] = NULL;
+}
+
+// Instantiates the world, generates the terrains and binds all the buffers.
+World::World(glm::vec3 position, float radius, unsigned int mode)
+: World(position, radius) {
+    CpuProfileZone zone("world generation");
+
+    this->setMode(mode);
 
     // Generate every mode's block.
     this->generateBase(WORLD_MODE_BASE, WORLD_SQUARE_COUNT);
@@ -56,21 +72,66 @@ World::World(glm::vec3 position, float radius, unsigned int mode) {
 // Destructor.
 World::~World() {
     for (int i = 0; i < WORLD_MODE_COUNT; i++) {
-        glDeleteBuffers(1, &(this->blocks[i]->vao));
+        if (!this->blocks[i]) continue;
+
+        for (int lod = 0; lod < WORLD_LOD_COUNT; lod++) {
+            GLState::forgetVertexArray(this->blocks[i]->vao[lod]);
+        }
+        GLState::forgetTexture(this->blocks[i]->band_texture);
+        glDeleteVertexArrays(WORLD_LOD_COUNT, this->blocks[i]->vao);
         glDeleteBuffers(1, &(this->blocks[i]->vbo));
-        glDeleteBuffers(1, &(this->blocks[i]->ibo));
+        glDeleteBuffers(WORLD_LOD_COUNT, this->blocks[i]->ibo);
+        glDeleteTextures(1, &(this->blocks[i]->band_texture));
     }
 }
 
+// Drop a block that was never buffered, freeing its vertices, indexes and
+// color bands.
+void World::releaseBlock(unsigned int mode) {
+    WorldBlock* block = this->blocks[mode];
+
+    if (!block) return;
+
+    free(block->vertices);
+    for (unsigned int level = 0; level < WORLD_LOD_COUNT; level++) {
+        free(block->lod_indexes[level]);
+    }
+    free(block->bands);
+
+    delete block;
+    this->blocks[mode] = NULL;
+}
+
 // Set the current rendered mode.
 void World::setMode(unsigned int mode) { this->mode = mode; }
 
+// Switch between the baked and the procedural mountain colors.
+void World::switchColorBake() { this->baked_colors = !this->baked_colors; }
+
+// Select the terrain level of detail, 0 being the full grid.
+void World::setTerrainLevel(unsigned int level) {
+    this->terrain_level = glm::min(level, (unsigned int)WORLD_LOD_COUNT - 1);
+}
+unsigned int World::getTerrainLevel() { return this->terrain_level; }
+
+// Mountain color computation for the current mode, the shader drawing the
+// world has to be the matching variant.
+unsigned int World::getColorMode() {
+    WorldBlock* block = this->blocks[this->mode];
+
+    if (!block || this->mode == WORLD_MODE_BASE) return WORLD_COLORS_NONE;
+    if (this->baked_colors && block->band_texture) return WORLD_COLORS_BAKED;
+    return WORLD_COLORS_PROCEDURAL;
+}
+
 // Render the block on the correct position around the camera.
 // We always render 4 blocks, that cover the fog radius completely.
 void World::render(unsigned int shader, glm::mat4 model_matrix,
     glm::vec3 position, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]) {
+    GLStateScope scope(GL_STATE_SCOPE_WORLD);
     WorldBlock* block = this->blocks[this->mode];
     glm::vec3 direction = glm::vec3((*cameraToWorldMatrix)[3]);
+    unsigned int level = this->terrain_level;
 
     // The start point can be found by dividing the current distance from the
     // origin point by the length of the block, rounding it to the closest
@@ -90,35 +151,49 @@ void World::render(unsigned int shader, glm::mat4 model_matrix,
                 this->boundary_top.s, this->boundary_top.t);
             glUniform2f(glGetUniformLocation(shader, "boundary_bottom"),
                 this->boundary_bottom.s, this->boundary_bottom.t);
-            glUniform1i(glGetUniformLocation(shader, "draw_mountain"), true);
+
+            // Use the color bands baked at generation time, if available.
+            if (this->getColorMode() == WORLD_COLORS_BAKED) {
+                GLState::bindTexture(WORLD_BAND_TEXTURE_UNIT, GL_TEXTURE_2D,
+                    block->band_texture);
+                glUniform1i(glGetUniformLocation(shader, "mountain_bands"),
+                    WORLD_BAND_TEXTURE_UNIT);
+                glUniform1f(glGetUniformLocation(shader, "block_length"),
+                    this->length);
+            }
         }
 
+        // Bounds the packed positions are relative to.
+        glUniform3f(glGetUniformLocation(shader, "position_offset"),
+            block->position_offset.x, block->position_offset.y,
+            block->position_offset.z);
+        glUniform3f(glGetUniformLocation(shader, "position_scale"),
+            block->position_scale.x, block->position_scale.y,
+            block->position_scale.z);
+
         // Render all the blocks, starting from the previously
-        RawModelFactory::render(block->vao, block->total_index_count,
+        RawModelFactory::render(block->vao[level], block->lod_index_count[level],
             (RawModelMaterial*)materials[this->mode],
             start, glm::vec3(1, 1, 1),
             model_matrix, glm::mat4(), shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
 
-        RawModelFactory::render(block->vao, block->total_index_count,
+        RawModelFactory::render(block->vao[level], block->lod_index_count[level],
             (RawModelMaterial*)materials[this->mode],
             start + glm::vec3(-this->length, 0, 0),
             glm::vec3(1, 1, 1),
             model_matrix, glm::mat4(), shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
 
-        RawModelFactory::render(block->vao, block->total_index_count,
+        RawModelFactory::render(block->vao[level], block->lod_index_count[level],
             (RawModelMaterial*)materials[this->mode],
             start + glm::vec3(0, 0, -this->length),
             glm::vec3(1, 1, 1),
             model_matrix, glm::mat4(), shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
 
-        RawModelFactory::render(block->vao, block->total_index_count,
+        RawModelFactory::render(block->vao[level], block->lod_index_count[level],
             (RawModelMaterial*)materials[this->mode],
             start + glm::vec3(-this->length, 0, -this->length),
             glm::vec3(1, 1, 1),
             model_matrix, glm::mat4(), shader, objectToWorldMatrix, projectionMatrix, cameraToWorldMatrix, modelViewProjectionMatrix, objectToWorldNormalMatrix, uniformBindingPoint, uniformBlock, uniformOffset);
-
-        // Inform the shader we're no longer drawing a mountain.
-        glUniform1i(glGetUniformLocation(shader, "draw_mountain"), false);
     }
 }
 
@@ -138,6 +213,7 @@ void World::generateBase(unsigned int mode, unsigned int square_count) {
 
 // Generate simple, non-tessellated fractal terrain.
 void World::generateTerrain(unsigned int mode, unsigned int square_count) {
+    CpuProfileZone zone("terrain generation");
     // Calculate the number of iterations. The total square count is
     // 4 ^ iterations, so starting from the desired number of quads we can
     // determine how many iterations should we execute.
@@ -170,6 +246,9 @@ void World::generateTerrain(unsigned int mode, unsigned int square_count) {
 
     // Compute normals.
     this->computeNormals(mode);
+
+    // The band colors only depend on the static terrain, bake them once.
+    this->bakeColorBands(mode);
 }
 
 // To tessellate a generated block, apply the fractal algorithm once more, to multiply the number of quads by 4.
@@ -386,12 +465,39 @@ WorldBlock* World::initializeBlock(unsigned int mode,
         }
     }
 
+    // Coarser levels of detail reuse the same vertices, taking only every
+    // stride-th one along each side. The quads are split like the full grid.
+    block->lod_indexes[0] = block->indexes;
+    block->lod_index_count[0] = block->total_index_count;
+
+    for (l = 1; l < WORLD_LOD_COUNT; l++) {
+        unsigned int stride = 1 << l;
+        unsigned int squares = block->square_count / stride;
+        unsigned int* indexes;
+
+        block->lod_index_count[l] = squares * squares * 6;
+        block->lod_indexes[l] = indexes = (unsigned int*)malloc(
+            sizeof(unsigned int) * block->lod_index_count[l]);
+
+        for (i = 0, n = 0; i < squares; i++) {
+            for (j = 0; j < squares; j++) {
+                k = i * stride * block->vertex_count + j * stride;
+                m = k + stride * block->vertex_count;
+
+                indexes[n++] = k; indexes[n++] = k + stride; indexes[n++] = m;
+                indexes[n++] = k + stride; indexes[n++] = m + stride;
+                indexes[n++] = m;
+            }
+        }
+    }
+
     return block;
 }
 
 // To compute vertex normals, we first compute triangle normals and then
 // average those for each vertex.
 void World::computeNormals(unsigned int mode) {
+    CpuProfileZone zone("terrain normals");
     unsigned int i, j, k, l, m, n;
     WorldBlock* block = this->blocks[mode];
     WorldVertex *p1, *p2, *p3;
@@ -458,6 +564,91 @@ void World::computeNormals(unsigned int mode) {
     }
 }
 
+// Mountain noise, matching noise() in min.frag at the best quality. Like the
+// shader, it samples the X / height plane of the object space position.
+static float mountainNoise(glm::vec2 position) {
+    float noise = 0;
+
+    // A zero frequency octave would be simplex(0), 0, so counting starts at 1.
+    for (int i = 1; i <= QUALITY_NOISE_OCTAVES; i++) {
+        float frequency = 0.01f * i;
+        float amplitude = 3.4f / i;
+
+        noise += glm::simplex(position * frequency) * amplitude;
+    }
+
+    return noise * 11;
+}
+
+// Bakes the mountain color band weights computed by computeMountainColor
+// into a texture covering the block, so the fragment shader only has to
+// sample it. The terrain height is interpolated across the same triangles
+// the GPU rasterizes. Rows are split between the available cores.
+void World::bakeColorBands(unsigned int mode) {
+    CpuProfileZone zone("color band bake");
+    WorldBlock* block = this->blocks[mode];
+    const unsigned int size = WORLD_BAND_TEXTURE_SIZE;
+    const glm::vec2 top = this->boundary_top;
+    const glm::vec2 bottom = this->boundary_bottom;
+    const float length = this->length;
+
+    block->bands = (unsigned char*)malloc(size * size * 2);
+
+    auto bakeRows = [block, size, top, bottom, length](unsigned int first,
+        unsigned int last) {
+        CpuProfileZone zone("color band rows");
+        unsigned int vertex_count = block->vertex_count;
+        unsigned int limit = block->square_count - 1;
+
+        for (unsigned int t = first; t < last; t++) {
+            float z = (t + 0.5f) / size * length;
+            float w = z / block->square_size;
+            unsigned int j = glm::min((unsigned int)w, limit);
+            float fw = w - j;
+
+            for (unsigned int s = 0; s < size; s++) {
+                float x = (s + 0.5f) / size * length;
+                float u = x / block->square_size;
+                unsigned int i = glm::min((unsigned int)u, limit);
+                float fu = u - i;
+
+                // Quad corners, split along the b-c diagonal by the indexes.
+                float a = block->vertices[i * vertex_count + j].position.y;
+                float b = block->vertices[i * vertex_count + j + 1].position.y;
+                float c = block->vertices[(i + 1) * vertex_count + j].position.y;
+                float d = block->vertices[(i + 1) * vertex_count + j + 1]
+                    .position.y;
+                float y = (fu + fw <= 1.0f) ?
+                    a + (c - a) * fu + (b - a) * fw :
+                    d + (b - d) * (1.0f - fu) + (c - d) * (1.0f - fw);
+
+                float height = y - mountainNoise(glm::vec2(x, y));
+
+                float top_percentage = glm::clamp(1 - (height - top.x) /
+                    (top.y - top.x), 0.0f, 1.0f);
+                float bottom_percentage = glm::clamp(1 - (height - bottom.x) /
+                    (bottom.y - bottom.x), 0.0f, 1.0f);
+
+                unsigned char* texel = &block->bands[(t * size + s) * 2];
+                texel[0] = (unsigned char)(top_percentage * 255.0f + 0.5f);
+                texel[1] = (unsigned char)(bottom_percentage * 255.0f + 0.5f);
+            }
+        }
+    };
+
+    unsigned int thread_count = glm::max(std::thread::hardware_concurrency(), 1u);
+    unsigned int rows = (size + thread_count - 1) / thread_count;
+    std::vector<std::thread> threads;
+
+    for (unsigned int first = 0; first < size; first += rows) {
+        threads.push_back(std::thread(bakeRows, first,
+            glm::min(first + rows, size)));
+    }
+    for (unsigned int k = 0; k < threads.size(); k++) {
+        threads[k].join();
+    }
+}
+
 glm::vec3 World::getBlockPos(glm::vec3 pos)
 {
 	return glm::vec3();
@@ -465,6 +656,7 @@ glm::vec3 World::getBlockPos(glm::vec3 pos)
 
 // Binds the buffers for later rendering.
 void World::bufferData() {
+    CpuProfileZone zone("terrain upload");
     WorldBlock* block;
     unsigned int i;
 
@@ -473,28 +665,85 @@ void World::bufferData() {
         block = this->blocks[i];
 
         if (block) {
-            glGenVertexArrays(1, &(block->vao));
-            glBindVertexArray(block->vao);
+            // Pack the vertices relative to the block bounds.
+            glm::vec3 minimum = block->vertices[0].position;
+            glm::vec3 maximum = minimum;
+            for (unsigned int v = 1; v < block->total_vertex_count; v++) {
+                minimum = glm::min(minimum, block->vertices[v].position);
+                maximum = glm::max(maximum, block->vertices[v].position);
+            }
+            block->position_offset = minimum;
+            block->position_scale = maximum - minimum;
+
+            glm::vec3 inverse_scale = glm::vec3(
+                block->position_scale.x > 0 ? 1 / block->position_scale.x : 0,
+                block->position_scale.y > 0 ? 1 / block->position_scale.y : 0,
+                block->position_scale.z > 0 ? 1 / block->position_scale.z : 0);
+            std::vector<WorldPackedVertex> packed(block->total_vertex_count);
+
+            for (unsigned int v = 0; v < block->total_vertex_count; v++) {
+                glm::vec3 position = (block->vertices[v].position - minimum) *
+                    inverse_scale;
+                glm::vec2 normal = mesh::_encodeOctahedral(
+                    block->vertices[v].normal);
+
+                packed[v].position[0] = mesh::_packUnorm16(position.x);
+                packed[v].position[1] = mesh::_packUnorm16(position.y);
+                packed[v].position[2] = mesh::_packUnorm16(position.z);
+                packed[v].padding = 0;
+                packed[v].normal[0] = mesh::_packSnorm16(normal.x);
+                packed[v].normal[1] = mesh::_packSnorm16(normal.y);
+            }
 
             glGenBuffers(1, &(block->vbo));
             glBindBuffer(GL_ARRAY_BUFFER, block->vbo);
             glBufferData(GL_ARRAY_BUFFER, block->total_vertex_count *
-                sizeof(WorldVertex), block->vertices, GL_STATIC_DRAW);
-
-            glGenBuffers(1, &(block->ibo));
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block->ibo);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, block->total_index_count *
-                sizeof(unsigned int), block->indexes, GL_STATIC_DRAW);
+                sizeof(WorldPackedVertex), &packed[0], GL_STATIC_DRAW);
+
+            // One vertex array per level of detail, sharing the vertices.
+            glGenVertexArrays(WORLD_LOD_COUNT, block->vao);
+            glGenBuffers(WORLD_LOD_COUNT, block->ibo);
+
+            for (unsigned int level = 0; level < WORLD_LOD_COUNT; level++) {
+                GLState::bindVertexArray(block->vao[level]);
+
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block->ibo[level]);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                    block->lod_index_count[level] * sizeof(unsigned int),
+                    block->lod_indexes[level], GL_STATIC_DRAW);
+
+                glEnableVertexAttribArray(6);
+                glVertexAttribPointer(6, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+                    sizeof(WorldPackedVertex), (void*)0);
+                glEnableVertexAttribArray(7);
+                glVertexAttribPointer(7, 2, GL_SHORT, GL_TRUE,
+                    sizeof(WorldPackedVertex),
+                    (void*)(4 * sizeof(unsigned short)));
+            }
 
-            glEnableVertexAttribArray(6);
-            glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(WorldVertex),
-                (void*)0);
-            glEnableVertexAttribArray(7);
-			glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE , sizeof(WorldVertex),
-                (void*)(3 * sizeof(float)));
+            // Upload the baked mountain colors, wrapping like the block.
+            if (block->bands) {
+                glGenTextures(1, &(block->band_texture));
+                GLState::bindTexture(WORLD_BAND_TEXTURE_UNIT, GL_TEXTURE_2D,
+                    block->band_texture);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, WORLD_BAND_TEXTURE_SIZE,
+                    WORLD_BAND_TEXTURE_SIZE, 0, GL_RG, GL_UNSIGNED_BYTE,
+                    block->bands);
+                glGenerateMipmap(GL_TEXTURE_2D);
+
+                free(block->bands);
+                block->bands = NULL;
+            }
 
             free(block->vertices);
-            free(block->indexes);
+            for (unsigned int level = 0; level < WORLD_LOD_COUNT; level++) {
+                free(block->lod_indexes[level]);
+            }
         }
     }
 }
\ No newline at end of file
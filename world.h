@@ -14,6 +14,8 @@
 #include "raw_model.h"
 #include <math.h>
 #include <random>
+#include <thread>
+#include <vector>
 
 // World modes.
 #define WORLD_MODE_BASE 0
@@ -21,9 +23,21 @@
 
 #define WORLD_MODE_COUNT 2
 
+// How the mountain colors are computed, selects the shader variant
+// (MOUNTAIN_COLORS in min.frag).
+#define WORLD_COLORS_NONE 0
+#define WORLD_COLORS_PROCEDURAL 1
+#define WORLD_COLORS_BAKED 2
+
+#define WORLD_COLORS_COUNT 3
+
 // Number of squares on the side of a terrain block, for the base mode.
 #define WORLD_SQUARE_COUNT 256
 
+// Number of terrain levels of detail. Level n skips 2 ^ n vertices along
+// each side of the block, so it draws 4 ^ n times fewer triangles.
+#define WORLD_LOD_COUNT 3
+
 // The range in which the height is displaced for the fractal generation.
 #define WORLD_FRACTAL_DISPLACEMENT_RANGE 1200.0f
 static const float WORLD_FRACTAL_Y_OFFSET = -WORLD_FRACTAL_DISPLACEMENT_RANGE * 0.5f;
@@ -44,6 +58,11 @@ static const glm::vec4 WORLD_BOTTOM_COLOR = glm::vec4(0.1f, 0.1f, 0.1f, 1);
 #define WORLD_BOUNDARY_BOTTOM 0.9f
 #define WORLD_BOUNDARY_BOTTOM_LOW 1.8f
 
+// Resolution of the baked mountain color band texture, per block side, and
+// the texture unit it is bound to while drawing.
+#define WORLD_BAND_TEXTURE_SIZE 1024
+#define WORLD_BAND_TEXTURE_UNIT 1
+
 // Materials used for the various modes.
 static const RawModelMaterial material_neutral = RawModelMaterial(50,
     glm::vec4(0.18f, 0.18f, 0.18f, 1),
@@ -73,15 +92,31 @@ struct WorldVertex {
     WorldVertex(glm::vec3 position, glm::vec3 normal);
 };
 
+// What is uploaded for a terrain vertex, 12 bytes instead of 24: the position
+// as 16 bit unorms inside the block bounds, the normal octahedral encoded
+// (see mesh::PackedVertexFormat).
+struct WorldPackedVertex {
+    unsigned short position[3], padding;
+    short normal[2];
+};
+
 // Block structure, containing the actual VBO information.
 struct WorldBlock {
-    unsigned int vao;
+    unsigned int vao[WORLD_LOD_COUNT];
     unsigned int vbo;
-    unsigned int ibo;
+    unsigned int ibo[WORLD_LOD_COUNT];
 
     WorldVertex* vertices;
     unsigned int* indexes;
 
+    // Indexes for each level of detail, level 0 is indexes.
+    unsigned int* lod_indexes[WORLD_LOD_COUNT];
+    unsigned int lod_index_count[WORLD_LOD_COUNT];
+
+    // Baked mountain color band weights (top, bottom), RG8.
+    unsigned char* bands;
+    unsigned int band_texture;
+
     unsigned int square_count;
     unsigned int vertex_count;
 
@@ -90,14 +125,27 @@ struct WorldBlock {
     unsigned int total_index_count;
     unsigned int total_vertex_count;
     float square_size;
+
+    // Decode of the packed positions, the block bounds.
+    glm::vec3 position_offset, position_scale;
 };
 
 class World {
 public:
     World(glm::vec3 position, float radius, unsigned int mode);
+    // Empty world, blocks are generated by hand and never buffered.
+    World(glm::vec3 position, float radius);
     ~World();
 
+    // Seed the terrain generator, for a repeatable world. Call before
+    // creating the world.
+    static void setSeed(unsigned int seed);
+
     void setMode(unsigned int mode);
+    void switchColorBake();
+    void setTerrainLevel(unsigned int level);
+    unsigned int getTerrainLevel();
+    unsigned int getColorMode();
     void render(unsigned int shader, glm::mat4 model_matrix,
         glm::vec3 position, glm::mat4* objectToWorldMatrix, glm::mat4* projectionMatrix, glm::mat4* cameraToWorldMatrix, glm::mat4* modelViewProjectionMatrix, glm::mat3* objectToWorldNormalMatrix, GLuint uniformBindingPoint, GLuint uniformBlock, GLint uniformOffset[]);
 
@@ -108,7 +156,9 @@ public:
     void generateFractal(unsigned int mode, unsigned int iteration);
     WorldBlock* initializeBlock(unsigned int mode, unsigned int square_count);
     void bufferData();
+    void releaseBlock(unsigned int mode);
     void computeNormals(unsigned int mode);
+    void bakeColorBands(unsigned int mode);
 
 	glm::vec3 getBlockPos(glm::vec3 pos);
 
@@ -118,5 +168,7 @@ private:
     float length;
     float radius;
     glm::vec2 boundary_top, boundary_bottom;
+    bool baked_colors;
+    unsigned int terrain_level;
     WorldBlock* blocks[WORLD_MODE_COUNT];
 };
\ No newline at end of file